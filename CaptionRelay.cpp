@@ -0,0 +1,144 @@
+#include "CaptionRelay.h"
+#include "Logger.h"
+#include "utils/Json.h"
+#include "utils/ScopedGLibMem.h"
+
+namespace
+{
+
+// Frames are decoded within a few frame intervals, older entries belong to frames the decoder dropped
+const size_t maxPendingFrames = 64;
+
+const char* captionTypeName(GstVideoCaptionType type)
+{
+    switch (type)
+    {
+    case GST_VIDEO_CAPTION_TYPE_CEA608_RAW:
+        return "cea608_raw";
+    case GST_VIDEO_CAPTION_TYPE_CEA608_S334_1A:
+        return "cea608_s334_1a";
+    case GST_VIDEO_CAPTION_TYPE_CEA708_RAW:
+        return "cea708_raw";
+    case GST_VIDEO_CAPTION_TYPE_CEA708_CDP:
+        return "cea708_cdp";
+    default:
+        return "unknown";
+    }
+}
+
+} // namespace
+
+CaptionRelay::CaptionRelay(GstElement* parser, Config::CaptionMode mode, MessageSender messageSender)
+    : mode_(mode),
+      messageSender_(std::move(messageSender)),
+      parserSrcPad_(gst_element_get_static_pad(parser, "src")),
+      parserProbeId_(0),
+      encoderSinkPad_(nullptr),
+      encoderProbeId_(0)
+{
+    parserProbeId_ = gst_pad_add_probe(parserSrcPad_, GST_PAD_PROBE_TYPE_BUFFER, parserProbe, this, nullptr);
+}
+
+CaptionRelay::~CaptionRelay()
+{
+    gst_pad_remove_probe(parserSrcPad_, parserProbeId_);
+    gst_object_unref(parserSrcPad_);
+    if (encoderSinkPad_)
+    {
+        gst_pad_remove_probe(encoderSinkPad_, encoderProbeId_);
+        gst_object_unref(encoderSinkPad_);
+    }
+}
+
+void CaptionRelay::attachEncoder(GstElement* encoder)
+{
+    if (mode_ != Config::CaptionMode::SEI || encoderSinkPad_)
+    {
+        return;
+    }
+    encoderSinkPad_ = gst_element_get_static_pad(encoder, "sink");
+    encoderProbeId_ = gst_pad_add_probe(encoderSinkPad_, GST_PAD_PROBE_TYPE_BUFFER, encoderProbe, this, nullptr);
+}
+
+void CaptionRelay::onParsedFrame(GstPad* pad, GstBuffer* buffer)
+{
+    auto meta = gst_buffer_get_video_caption_meta(buffer);
+    if (!meta || meta->size == 0 || !GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        return;
+    }
+
+    if (mode_ == Config::CaptionMode::SEI)
+    {
+        std::lock_guard<std::mutex> lock(captionsMutex_);
+        if (captions_.size() >= maxPendingFrames)
+        {
+            captions_.erase(captions_.begin());
+        }
+        captions_[GST_BUFFER_PTS(buffer)] = {meta->caption_type,
+            std::vector<uint8_t>(meta->data, meta->data + meta->size)};
+        return;
+    }
+
+    // Receivers place the captions on the video by running time, like the SCTE-35 cues
+    auto runningTime = GST_CLOCK_TIME_NONE;
+    auto segmentEvent = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+    if (segmentEvent)
+    {
+        const GstSegment* segment = nullptr;
+        gst_event_parse_segment(segmentEvent, &segment);
+        runningTime = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+        gst_event_unref(segmentEvent);
+    }
+
+    using utils::Json::field;
+    utils::ScopedGLibMem base64(g_base64_encode(meta->data, meta->size));
+    messageSender_("{" + field("type", "captions") + "," + field("format", captionTypeName(meta->caption_type)) + "," +
+        (GST_CLOCK_TIME_IS_VALID(runningTime) ? field("runningTimeMs", static_cast<double>(runningTime) / GST_MSECOND)
+                                              : field("runningTimeMs", std::string("null"))) +
+        "," + field("data", base64.get()) + "}");
+}
+
+GstPadProbeReturn CaptionRelay::onRawFrame(GstPadProbeInfo* info)
+{
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    Captions captions;
+    {
+        std::lock_guard<std::mutex> lock(captionsMutex_);
+        const auto findResult = captions_.find(GST_BUFFER_PTS(buffer));
+        if (findResult == captions_.end())
+        {
+            return GST_PAD_PROBE_OK;
+        }
+        captions = std::move(findResult->second);
+        captions_.erase(captions_.begin(), std::next(findResult));
+    }
+
+    // The decoder may have carried the meta over already
+    if (gst_buffer_get_video_caption_meta(buffer))
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Only the buffer's metadata is copied if it is shared, the frame memory is not
+    buffer = gst_buffer_make_writable(buffer);
+    gst_buffer_add_video_caption_meta(buffer, captions.type_, captions.data_.data(), captions.data_.size());
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn CaptionRelay::parserProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData)
+{
+    reinterpret_cast<CaptionRelay*>(userData)->onParsedFrame(pad, GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn CaptionRelay::encoderProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    return reinterpret_cast<CaptionRelay*>(userData)->onRawFrame(info);
+}
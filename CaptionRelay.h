@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Config.h"
+#include <cstdint>
+#include <functional>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Carries the source's closed captions past decoding and encoding. The parsers extract CEA-608/708 user data into
+ * GstVideoCaptionMeta on the compressed frames, where it is read without touching the frame data. In SEI mode the
+ * caption data is kept by timestamp and attached again to the matching raw frame in front of the encoder, which
+ * writes it out as SEI, unless the frame still carries it. In data channel mode each frame's caption data is sent as
+ * one JSON message with its running time.
+ */
+class CaptionRelay
+{
+public:
+    using MessageSender = std::function<void(const std::string& message)>;
+
+    CaptionRelay(GstElement* parser, Config::CaptionMode mode, MessageSender messageSender);
+    ~CaptionRelay();
+
+    void attachEncoder(GstElement* encoder);
+
+private:
+    struct Captions
+    {
+        GstVideoCaptionType type_;
+        std::vector<uint8_t> data_;
+    };
+
+    Config::CaptionMode mode_;
+    MessageSender messageSender_;
+    GstPad* parserSrcPad_;
+    gulong parserProbeId_;
+    GstPad* encoderSinkPad_;
+    gulong encoderProbeId_;
+
+    // Caption data by PTS, waiting for the decoded frame
+    std::mutex captionsMutex_;
+    std::map<GstClockTime, Captions> captions_;
+
+    void onParsedFrame(GstPad* pad, GstBuffer* buffer);
+    GstPadProbeReturn onRawFrame(GstPadProbeInfo* info);
+
+    static GstPadProbeReturn parserProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn encoderProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+};
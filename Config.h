@@ -4,9 +4,24 @@
 #include <chrono>
 #include <cstdint>
 #include <string>
+#include <vector>
 
 struct Config
 {
+    struct RestreamDestination
+    {
+        std::string address_;
+        uint32_t port_;
+        bool srt_;
+    };
+
+    enum class CaptionMode
+    {
+        OFF,
+        SEI,
+        DATA_CHANNEL
+    };
+
     Config()
         : whipEndpointUrl_(),
           whipEndpointAuthKey_(),
@@ -15,18 +30,56 @@ struct Config
           udpSourceQueueMinTime_(0),
           restreamAddress_(),
           restreamPort_(0),
+          restreamDestinations_(),
+          restreamQueueMaxTime_(500),
+          statsInterval_(10),
           showTimer_(false),
           srtTransport_(false),
           srtMode_(2),
           tsDemuxLatency_(0),
           jitterBufferLatency_(0),
           srtSourceLatency_(125),
+          srtLatencyAutoTune_(false),
+          srtLatencyMin_(60),
+          srtLatencyMax_(5000),
+          srtStreamIdMap_(),
+          applicationSource_(false),
           h264encodeBitrate(2000),
           audio_(true),
           video_(true),
           bypass_audio_(false),
           bypass_video_(false),
-          ignorePcr_(false)
+          ignorePcr_(false),
+          pcrClockRecovery_(false),
+          rtpPacing_(false),
+          fastStart_(false),
+          keyframeMinInterval_(500),
+          videoEncoder_("x264"),
+          videoEncoderBenchmark_(false),
+          audioLanguages_(),
+          audioTracks_(1),
+          encoderThreads_(2),
+          decoderThreads_(0),
+          cpuSet_(),
+          numaNode_(-1),
+          cpusPerChannel_(0),
+          ingestPriority_(0),
+          controlSocket_(),
+          sourceIdleTimeout_(0),
+          slateFile_(),
+          scte35_(false),
+          captions_(CaptionMode::OFF),
+          timedMetadata_(false),
+          recordDirectory_(),
+          recordSegmentDuration_(60),
+          recordSegments_(10),
+          recordSegmentSize_(256),
+          inputFile_(),
+          inputFast_(false),
+          fakeOutput_(false),
+          tracers_(false),
+          memoryBudget_(0),
+          lowLatency_(false)
     {
         // Load ignorePcr from environment variable if set
         const char* ignorePcrEnv = std::getenv("IGNORE_PCR");
@@ -60,6 +113,21 @@ struct Config
         result.append("restreamPort: ");
         result.append(std::to_string(restreamPort_));
         result.append("\n");
+        for (const auto& destination : restreamDestinations_)
+        {
+            result.append("restreamDestination: ");
+            result.append(destination.srt_ ? "srt://" : "udp://");
+            result.append(destination.address_);
+            result.append(":");
+            result.append(std::to_string(destination.port_));
+            result.append("\n");
+        }
+        result.append("restreamQueueMaxTime: ");
+        result.append(std::to_string(restreamQueueMaxTime_.count()));
+        result.append("\n");
+        result.append("statsInterval: ");
+        result.append(std::to_string(statsInterval_.count()));
+        result.append("\n");
         result.append("h264encodeBitrate: ");
         result.append(std::to_string(h264encodeBitrate));
         result.append("\n");
@@ -81,6 +149,16 @@ struct Config
         result.append("srtSourceLatency: ");
         result.append(std::to_string(srtSourceLatency_));
         result.append("\n");
+        result.append("srtLatencyAutoTune: ");
+        result.append(srtLatencyAutoTune_ ? "true" : "false");
+        result.append(" (");
+        result.append(std::to_string(srtLatencyMin_));
+        result.append("-");
+        result.append(std::to_string(srtLatencyMax_));
+        result.append(" ms)\n");
+        result.append("srtStreamIdMap: ");
+        result.append(srtStreamIdMap_.empty() ? "unset" : srtStreamIdMap_);
+        result.append("\n");
         result.append("audio: ");
         result.append(audio_ ? "true" : "false");
         result.append("\n");
@@ -95,6 +173,103 @@ struct Config
         result.append("\n");
         result.append("ignore PCR: ");
         result.append(ignorePcr_ ? "true" : "false");
+        result.append("\n");
+        result.append("pcrClockRecovery: ");
+        result.append(pcrClockRecovery_ ? "true" : "false");
+        result.append("\n");
+        result.append("rtpPacing: ");
+        result.append(rtpPacing_ ? "true" : "false");
+        result.append("\n");
+        result.append("fastStart: ");
+        result.append(fastStart_ ? "true" : "false");
+        result.append("\n");
+        result.append("keyframeMinInterval: ");
+        result.append(std::to_string(keyframeMinInterval_.count()));
+        result.append("\n");
+        result.append("videoEncoder: ");
+        result.append(videoEncoder_);
+        result.append("\n");
+        result.append("videoEncoderBenchmark: ");
+        result.append(videoEncoderBenchmark_ ? "true" : "false");
+        result.append("\n");
+        result.append("audioLanguage: ");
+        for (size_t i = 0; i < audioLanguages_.size(); ++i)
+        {
+            result.append(i == 0 ? "" : ",");
+            result.append(audioLanguages_[i]);
+        }
+        result.append(audioLanguages_.empty() ? "unset" : "");
+        result.append("\n");
+        result.append("audioTracks: ");
+        result.append(std::to_string(audioTracks_));
+        result.append("\n");
+        result.append("encoderThreads: ");
+        result.append(std::to_string(encoderThreads_));
+        result.append("\n");
+        result.append("decoderThreads: ");
+        result.append(decoderThreads_ == 0 ? "auto" : std::to_string(decoderThreads_));
+        result.append("\n");
+        result.append("cpuSet: ");
+        result.append(cpuSet_.empty() ? "unset" : cpuSet_);
+        result.append("\n");
+        result.append("numaNode: ");
+        result.append(numaNode_ < 0 ? "unset" : std::to_string(numaNode_));
+        result.append("\n");
+        result.append("cpusPerChannel: ");
+        result.append(cpusPerChannel_ == 0 ? "all" : std::to_string(cpusPerChannel_));
+        result.append("\n");
+        result.append("ingestPriority: ");
+        result.append(ingestPriority_ == 0 ? "off" : std::to_string(ingestPriority_));
+        result.append("\n");
+        result.append("controlSocket: ");
+        result.append(controlSocket_.empty() ? "unset" : controlSocket_);
+        result.append("\n");
+        result.append("sourceIdleTimeout: ");
+        result.append(std::to_string(sourceIdleTimeout_.count()));
+        result.append("\n");
+        result.append("slateFile: ");
+        result.append(slateFile_.empty() ? "unset" : slateFile_);
+        result.append("\n");
+        result.append("scte35: ");
+        result.append(scte35_ ? "true" : "false");
+        result.append("\n");
+        result.append("captions: ");
+        result.append(captions_ == CaptionMode::SEI            ? "sei"
+                : captions_ == CaptionMode::DATA_CHANNEL ? "datachannel"
+                                                         : "off");
+        result.append("\n");
+        result.append("timedMetadata: ");
+        result.append(timedMetadata_ ? "true" : "false");
+        result.append("\n");
+        result.append("recordDirectory: ");
+        result.append(recordDirectory_.empty() ? "unset" : recordDirectory_);
+        result.append("\n");
+        result.append("recordSegmentDuration: ");
+        result.append(std::to_string(recordSegmentDuration_.count()));
+        result.append("\n");
+        result.append("recordSegments: ");
+        result.append(std::to_string(recordSegments_));
+        result.append("\n");
+        result.append("recordSegmentSize: ");
+        result.append(std::to_string(recordSegmentSize_));
+        result.append("\n");
+        result.append("inputFile: ");
+        result.append(inputFile_.empty() ? "unset" : inputFile_);
+        result.append("\n");
+        result.append("inputFast: ");
+        result.append(inputFast_ ? "true" : "false");
+        result.append("\n");
+        result.append("fakeOutput: ");
+        result.append(fakeOutput_ ? "true" : "false");
+        result.append("\n");
+        result.append("tracers: ");
+        result.append(tracers_ ? "true" : "false");
+        result.append("\n");
+        result.append("memoryBudget: ");
+        result.append(std::to_string(memoryBudget_));
+        result.append("\n");
+        result.append("lowLatency: ");
+        result.append(lowLatency_ ? "true" : "false");
 
         return result;
     }
@@ -106,6 +281,9 @@ struct Config
     std::chrono::milliseconds udpSourceQueueMinTime_;
     std::string restreamAddress_;
     uint32_t restreamPort_;
+    std::vector<RestreamDestination> restreamDestinations_;
+    std::chrono::milliseconds restreamQueueMaxTime_;
+    std::chrono::seconds statsInterval_;
     bool showTimer_;
     bool srtTransport_;
     uint32_t srtMode_;
@@ -113,6 +291,13 @@ struct Config
     uint32_t tsDemuxLatency_;
     uint32_t jitterBufferLatency_;
     uint32_t srtSourceLatency_;
+    bool srtLatencyAutoTune_;
+    uint32_t srtLatencyMin_;
+    uint32_t srtLatencyMax_;
+    std::string srtStreamIdMap_;
+
+    // Set for pipelines fed through Pipeline::pushSourceData instead of their own udpsrc/srtsrc
+    bool applicationSource_;
     uint32_t h264encodeBitrate;
 
     bool audio_;
@@ -121,4 +306,58 @@ struct Config
     bool bypass_audio_;
     bool bypass_video_;
     bool ignorePcr_;
+    bool pcrClockRecovery_;
+    bool rtpPacing_;
+    bool fastStart_;
+    std::chrono::milliseconds keyframeMinInterval_;
+    std::string videoEncoder_;
+    bool videoEncoderBenchmark_;
+    std::vector<std::string> audioLanguages_;
+    uint32_t audioTracks_;
+
+    // Thread budget of a channel, see ThreadBudget
+    uint32_t encoderThreads_;
+    uint32_t decoderThreads_;
+    std::string cpuSet_;
+    int32_t numaNode_;
+    uint32_t cpusPerChannel_;
+    uint32_t ingestPriority_;
+
+    std::string controlSocket_;
+
+    // Decoding and encoding are parked when the source sends nothing for this long, 0 disables it
+    std::chrono::milliseconds sourceIdleTimeout_;
+
+    // Pre-encoded H264 and Opus MPEG-TS clip looped into the payloaders while the source is idle
+    std::string slateFile_;
+
+    // Forward SCTE-35 cues on the "scte35" data channel and start a GOP at their splice points
+    bool scte35_;
+
+    // Where the source's closed captions go after the video is re-encoded
+    CaptionMode captions_;
+
+    // Forward KLV and ID3 timed metadata streams on the "metadata" data channel
+    bool timedMetadata_;
+
+    // Ring of recordSegments_ files of the raw source TS, each preallocated to recordSegmentSize_ MiB
+    std::string recordDirectory_;
+    std::chrono::seconds recordSegmentDuration_;
+    uint32_t recordSegments_;
+    uint32_t recordSegmentSize_;
+
+    // TS or pcap file replayed instead of the network source, paced by PCR or capture time unless inputFast_
+    std::string inputFile_;
+    bool inputFast_;
+    // RTP output goes to fakesinks instead of a WHIP session
+    bool fakeOutput_;
+
+    // GStreamer latency and rusage tracers, summarized per element every statsInterval_
+    bool tracers_;
+
+    // MiB of media data one pipeline may hold in queues and codecs before the ingest queue drops, 0 is unlimited
+    uint32_t memoryBudget_;
+
+    // Sliced threads and intra refresh in the encoder, NAL units payloaded as they come and no RTP pacing
+    bool lowLatency_;
 };
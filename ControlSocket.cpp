@@ -0,0 +1,129 @@
+#include "ControlSocket.h"
+#include "Logger.h"
+#include <gio/gunixsocketaddress.h>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ControlSocket::ControlSocket(const std::string& path, Handler handler)
+    : path_(path),
+      handler_(std::move(handler)),
+      service_(nullptr)
+{
+}
+
+ControlSocket::~ControlSocket()
+{
+    if (!service_)
+    {
+        return;
+    }
+
+    g_socket_service_stop(service_);
+    g_socket_listener_close(G_SOCKET_LISTENER(service_));
+    g_object_unref(service_);
+    unlink(path_.c_str());
+}
+
+bool ControlSocket::start()
+{
+    // A socket file left behind by a previous run would make the bind fail, anything else at the path is left alone
+    struct stat fileStatus = {};
+    if (lstat(path_.c_str(), &fileStatus) == 0)
+    {
+        if (!S_ISSOCK(fileStatus.st_mode))
+        {
+            Logger::log("Control socket path %s exists and is not a socket", path_.c_str());
+            return false;
+        }
+        unlink(path_.c_str());
+    }
+
+    service_ = g_socket_service_new();
+    auto address = g_unix_socket_address_new(path_.c_str());
+    GError* error = nullptr;
+    const auto added = g_socket_listener_add_address(G_SOCKET_LISTENER(service_),
+        address,
+        G_SOCKET_TYPE_STREAM,
+        G_SOCKET_PROTOCOL_DEFAULT,
+        nullptr,
+        nullptr,
+        &error);
+    g_object_unref(address);
+    if (!added)
+    {
+        Logger::log("Unable to listen on control socket %s: %s", path_.c_str(), error->message);
+        g_error_free(error);
+        return false;
+    }
+
+    g_signal_connect(service_, "incoming", G_CALLBACK(incomingCallback), this);
+    g_socket_service_start(service_);
+    Logger::log("Control socket listening on %s", path_.c_str());
+    return true;
+}
+
+void ControlSocket::onRequest(Request& request, gssize size)
+{
+    std::string command(request.buffer_.data(), size > 0 ? static_cast<size_t>(size) : 0);
+    const auto end = command.find_first_of("\r\n");
+    if (end != std::string::npos)
+    {
+        command.resize(end);
+    }
+
+    // A client that does not read must not stall the main loop, the request lives until the response is written
+    request.response_ = handler_(command) + "\n";
+    auto outputStream = g_io_stream_get_output_stream(G_IO_STREAM(request.connection_));
+    g_output_stream_write_all_async(outputStream,
+        request.response_.data(),
+        request.response_.size(),
+        G_PRIORITY_DEFAULT,
+        nullptr,
+        writeCallback,
+        &request);
+}
+
+gboolean ControlSocket::incomingCallback(GSocketService* /*service*/,
+    GSocketConnection* connection,
+    GObject* /*sourceObject*/,
+    gpointer userData)
+{
+    auto request = new Request{reinterpret_cast<ControlSocket*>(userData), connection, {}};
+    g_object_ref(connection);
+
+    auto inputStream = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    g_input_stream_read_async(inputStream,
+        request->buffer_.data(),
+        request->buffer_.size(),
+        G_PRIORITY_DEFAULT,
+        nullptr,
+        readCallback,
+        request);
+    return TRUE;
+}
+
+void ControlSocket::readCallback(GObject* source, GAsyncResult* result, gpointer userData)
+{
+    std::unique_ptr<Request> request(reinterpret_cast<Request*>(userData));
+    const auto size = g_input_stream_read_finish(G_INPUT_STREAM(source), result, nullptr);
+    if (size < 0)
+    {
+        g_object_unref(request->connection_);
+        return;
+    }
+    request->controlSocket_->onRequest(*request.release(), size);
+}
+
+void ControlSocket::writeCallback(GObject* source, GAsyncResult* result, gpointer userData)
+{
+    std::unique_ptr<Request> request(reinterpret_cast<Request*>(userData));
+    GError* error = nullptr;
+    if (!g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, nullptr, &error))
+    {
+        Logger::log("Control socket write failed: %s", error->message);
+        g_error_free(error);
+    }
+    g_io_stream_close(G_IO_STREAM(request->connection_), nullptr, nullptr);
+    g_object_unref(request->connection_);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <gio/gio.h>
+#include <string>
+
+/**
+ * Unix domain socket for live introspection. A client connects, writes one command line and reads back one JSON
+ * response line, then the connection is closed. Connections are served on the main loop with asynchronous reads and
+ * writes, so a slow client never blocks the pipelines, and handlers can touch pipeline state without extra locking.
+ */
+class ControlSocket
+{
+public:
+    using Handler = std::function<std::string(const std::string& command)>;
+
+    ControlSocket(const std::string& path, Handler handler);
+    ~ControlSocket();
+
+    bool start();
+
+private:
+    struct Request
+    {
+        ControlSocket* controlSocket_;
+        GSocketConnection* connection_;
+        std::array<char, 1024> buffer_;
+        std::string response_;
+    };
+
+    std::string path_;
+    Handler handler_;
+    GSocketService* service_;
+
+    void onRequest(Request& request, gssize size);
+
+    static gboolean incomingCallback(GSocketService* /*service*/,
+        GSocketConnection* connection,
+        GObject* /*sourceObject*/,
+        gpointer userData);
+    static void readCallback(GObject* source, GAsyncResult* result, gpointer userData);
+    static void writeCallback(GObject* source, GAsyncResult* result, gpointer userData);
+};
@@ -0,0 +1,217 @@
+#include "EncoderBenchmark.h"
+#include "Config.h"
+#include "Logger.h"
+#include "VideoEncoder.h"
+#include "utils/ScopedGLibObject.h"
+#include <ctime>
+
+namespace
+{
+
+// Raw frames are large, a few are enough to ride out encoder jitter
+const guint maxQueuedFrames = 8;
+
+gint64 threadCpuTimeNs()
+{
+    timespec time{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return static_cast<gint64>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+} // namespace
+
+EncoderBenchmark::EncoderBenchmark(GstBin* bin, const Config& config) : bin_(bin), config_(config), statsTimerId_(0)
+{
+    for (const auto& encoder : VideoEncoder::all())
+    {
+        if (!makeBranch(encoder))
+        {
+            continue;
+        }
+        Logger::log("Benchmarking video encoder %s (%s)", encoder.name_, encoder.encoderFactory_);
+    }
+
+    if (config_.statsInterval_.count() != 0)
+    {
+        statsTimerId_ = g_timeout_add_seconds(config_.statsInterval_.count(), logStatsCallback, this);
+    }
+}
+
+EncoderBenchmark::~EncoderBenchmark()
+{
+    if (statsTimerId_ != 0)
+    {
+        g_source_remove(statsTimerId_);
+    }
+}
+
+EncoderBenchmark::Branch* EncoderBenchmark::makeBranch(const VideoEncoder& encoder)
+{
+    auto branch = std::make_unique<Branch>();
+    branch->encoder_ = &encoder;
+    branch->queue_ = gst_element_factory_make("queue", nullptr);
+    branch->encoderElement_ = gst_element_factory_make(encoder.encoderFactory_, nullptr);
+    branch->sink_ = gst_element_factory_make("fakesink", nullptr);
+    if (!branch->queue_ || !branch->encoderElement_ || !branch->sink_)
+    {
+        Logger::log("Unable to make benchmark elements for encoder %s", encoder.name_);
+        for (auto element : {branch->queue_, branch->encoderElement_, branch->sink_})
+        {
+            if (element)
+            {
+                gst_object_unref(element);
+            }
+        }
+        return nullptr;
+    }
+
+    g_object_set(branch->queue_,
+        "max-size-buffers",
+        maxQueuedFrames,
+        "max-size-bytes",
+        0,
+        "max-size-time",
+        0,
+        "leaky",
+        2, // downstream
+        nullptr);
+
+    // Single threaded, so the queue thread's CPU clock covers all of the encoding work
+    encoder.configure_(branch->encoderElement_, config_.h264encodeBitrate, 1);
+
+    g_object_set(branch->sink_, "sync", FALSE, "async", FALSE, nullptr);
+
+    gst_bin_add_many(bin_, branch->queue_, branch->encoderElement_, branch->sink_, nullptr);
+    branches_.emplace_back(std::move(branch));
+    return branches_.back().get();
+}
+
+bool EncoderBenchmark::link(GstElement* tee)
+{
+    for (auto& branch : branches_)
+    {
+        if (!gst_element_link_many(tee, branch->queue_, branch->encoderElement_, branch->sink_, nullptr))
+        {
+            Logger::log("Benchmark encoder %s could not be linked.", branch->encoder_->name_);
+            return false;
+        }
+
+        utils::ScopedGLibObject queueSinkPad(gst_element_get_static_pad(branch->queue_, "sink"));
+        gst_pad_add_probe(queueSinkPad.get(), GST_PAD_PROBE_TYPE_BUFFER, frameInProbe, branch.get(), nullptr);
+
+        utils::ScopedGLibObject queueSrcPad(gst_element_get_static_pad(branch->queue_, "src"));
+        gst_pad_add_probe(queueSrcPad.get(), GST_PAD_PROBE_TYPE_BUFFER, encodeStartProbe, branch.get(), nullptr);
+
+        utils::ScopedGLibObject sinkPad(gst_element_get_static_pad(branch->sink_, "sink"));
+        gst_pad_add_probe(sinkPad.get(), GST_PAD_PROBE_TYPE_BUFFER, encodeEndProbe, branch.get(), nullptr);
+
+        // Linked once the first video stream shows up, by then the pipeline is already running
+        gst_element_sync_state_with_parent(branch->sink_);
+        gst_element_sync_state_with_parent(branch->encoderElement_);
+        gst_element_sync_state_with_parent(branch->queue_);
+    }
+    return true;
+}
+
+void EncoderBenchmark::logStats()
+{
+    const auto intervalSeconds = static_cast<double>(config_.statsInterval_.count());
+
+    for (auto& branch : branches_)
+    {
+        const uint64_t framesEncoded = branch->framesEncoded_;
+        const uint64_t cpuTime = branch->cpuTime_;
+        const uint64_t bytesOut = branch->bytesOut_;
+        const uint64_t latencySum = branch->latencySum_;
+        const uint64_t latencyCount = branch->latencyCount_;
+
+        guint queuedFrames = 0;
+        g_object_get(branch->queue_, "current-level-buffers", &queuedFrames, nullptr);
+        const uint64_t framesIn = branch->framesIn_;
+        const auto framesOut = framesEncoded + queuedFrames;
+        const auto framesDropped = framesIn > framesOut ? framesIn - framesOut : 0;
+
+        const auto frames = framesEncoded - branch->previousFramesEncoded_;
+        const auto latencies = latencyCount - branch->previousLatencyCount_;
+        const auto cpuMsPerFrame =
+            frames == 0 ? 0.0 : static_cast<double>(cpuTime - branch->previousCpuTime_) / 1000000.0 / frames;
+        const auto latencyMs =
+            latencies == 0 ? 0.0 : static_cast<double>(latencySum - branch->previousLatencySum_) / 1000.0 / latencies;
+        const auto kbps = static_cast<double>(bytesOut - branch->previousBytesOut_) * 8.0 / 1000.0 / intervalSeconds;
+
+        Logger::log("Encoder %s: %.2f ms cpu/frame, %.1f ms latency, %.1f kbps, %llu frames, %llu dropped",
+            branch->encoder_->name_,
+            cpuMsPerFrame,
+            latencyMs,
+            kbps,
+            static_cast<unsigned long long>(frames),
+            static_cast<unsigned long long>(framesDropped));
+
+        branch->previousFramesEncoded_ = framesEncoded;
+        branch->previousCpuTime_ = cpuTime;
+        branch->previousBytesOut_ = bytesOut;
+        branch->previousLatencySum_ = latencySum;
+        branch->previousLatencyCount_ = latencyCount;
+    }
+}
+
+gboolean EncoderBenchmark::logStatsCallback(gpointer userData)
+{
+    auto encoderBenchmark = reinterpret_cast<EncoderBenchmark*>(userData);
+    encoderBenchmark->logStats();
+    return G_SOURCE_CONTINUE;
+}
+
+GstPadProbeReturn EncoderBenchmark::frameInProbe(GstPad* /*pad*/, GstPadProbeInfo* /*info*/, gpointer userData)
+{
+    auto branch = reinterpret_cast<Branch*>(userData);
+    ++branch->framesIn_;
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn EncoderBenchmark::encodeStartProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto branch = reinterpret_cast<Branch*>(userData);
+
+    // The queue thread only encodes, so its CPU time since the previous frame is what that frame cost
+    const auto cpuTime = threadCpuTimeNs();
+    if (branch->threadCpuTime_ != 0)
+    {
+        branch->cpuTime_ += cpuTime - branch->threadCpuTime_;
+    }
+    branch->threadCpuTime_ = cpuTime;
+
+    const auto pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    if (GST_CLOCK_TIME_IS_VALID(pts))
+    {
+        std::lock_guard<std::mutex> lock(branch->inputTimesMutex_);
+        branch->inputTimes_[pts] = g_get_monotonic_time();
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn EncoderBenchmark::encodeEndProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto branch = reinterpret_cast<Branch*>(userData);
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    ++branch->framesEncoded_;
+    branch->bytesOut_ += gst_buffer_get_size(buffer);
+
+    const auto pts = GST_BUFFER_PTS(buffer);
+    if (!GST_CLOCK_TIME_IS_VALID(pts))
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    std::lock_guard<std::mutex> lock(branch->inputTimesMutex_);
+    const auto findResult = branch->inputTimes_.find(pts);
+    if (findResult != branch->inputTimes_.end())
+    {
+        branch->latencySum_ += g_get_monotonic_time() - findResult->second;
+        ++branch->latencyCount_;
+    }
+
+    // Frames the encoder skipped never come out, forget everything up to this one
+    branch->inputTimes_.erase(branch->inputTimes_.begin(), branch->inputTimes_.upper_bound(pts));
+    return GST_PAD_PROBE_OK;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <gst/gst.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct Config;
+struct VideoEncoder;
+
+/**
+ * Encodes the decoded source video with every known encoder side by side and logs CPU time per frame, encode latency
+ * and output bitrate for each. Every encoder runs single threaded in its own queue thread, so the thread CPU clock
+ * read before each frame measures the encoder alone. Branches hang off a tee after videoconvert, their queues are
+ * leaky so an encoder that cannot keep up in real time drops frames instead of holding back the WHIP output.
+ */
+class EncoderBenchmark
+{
+public:
+    EncoderBenchmark(GstBin* bin, const Config& config);
+    ~EncoderBenchmark();
+
+    bool link(GstElement* tee);
+
+    static gboolean logStatsCallback(gpointer userData);
+
+private:
+    struct Branch
+    {
+        Branch()
+            : encoder_(nullptr),
+              queue_(nullptr),
+              encoderElement_(nullptr),
+              sink_(nullptr),
+              threadCpuTime_(0),
+              framesIn_(0),
+              framesEncoded_(0),
+              cpuTime_(0),
+              bytesOut_(0),
+              latencySum_(0),
+              latencyCount_(0),
+              previousFramesEncoded_(0),
+              previousCpuTime_(0),
+              previousBytesOut_(0),
+              previousLatencySum_(0),
+              previousLatencyCount_(0)
+        {
+        }
+
+        const VideoEncoder* encoder_;
+        GstElement* queue_;
+        GstElement* encoderElement_;
+        GstElement* sink_;
+
+        // Input timestamp to monotonic time when the frame entered the encoder
+        std::mutex inputTimesMutex_;
+        std::map<GstClockTime, gint64> inputTimes_;
+
+        // Thread CPU clock when the previous frame entered the encoder, only touched by the encoding thread
+        gint64 threadCpuTime_;
+
+        std::atomic<uint64_t> framesIn_;
+        std::atomic<uint64_t> framesEncoded_;
+        std::atomic<uint64_t> cpuTime_;
+        std::atomic<uint64_t> bytesOut_;
+        std::atomic<uint64_t> latencySum_;
+        std::atomic<uint64_t> latencyCount_;
+
+        // Previous snapshot for the per interval figures
+        uint64_t previousFramesEncoded_;
+        uint64_t previousCpuTime_;
+        uint64_t previousBytesOut_;
+        uint64_t previousLatencySum_;
+        uint64_t previousLatencyCount_;
+    };
+
+    GstBin* bin_;
+    const Config& config_;
+    std::vector<std::unique_ptr<Branch>> branches_;
+    guint statsTimerId_;
+
+    Branch* makeBranch(const VideoEncoder& encoder);
+    void logStats();
+
+    static GstPadProbeReturn frameInProbe(GstPad* /*pad*/, GstPadProbeInfo* /*info*/, gpointer userData);
+    static GstPadProbeReturn encodeStartProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn encodeEndProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+};
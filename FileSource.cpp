@@ -0,0 +1,231 @@
+#include "FileSource.h"
+#include "Config.h"
+#include "Logger.h"
+#include "utils/ScopedGLibObject.h"
+#include <ctime>
+
+namespace
+{
+
+gint64 processCpuTimeUs()
+{
+    timespec time{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return static_cast<gint64>(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+uint64_t bufferBytes(GstPadProbeInfo* info, uint64_t& buffers)
+{
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        auto bufferList = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        buffers = gst_buffer_list_length(bufferList);
+        return gst_buffer_list_calculate_size(bufferList);
+    }
+    buffers = 1;
+    return gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+}
+
+} // namespace
+
+FileSource::FileSource(GstBin* bin, const Config& config, EndHandler endHandler)
+    : bin_(bin),
+      config_(config),
+      endHandler_(std::move(endHandler)),
+      bytesIn_(0),
+      startTime_(0),
+      startCpuTime_(0),
+      firstTimestamp_(GST_CLOCK_TIME_NONE),
+      lastTimestamp_(GST_CLOCK_TIME_NONE),
+      summaryLogged_(false)
+{
+}
+
+GstElement* FileSource::make()
+{
+    if (!g_file_test(config_.inputFile_.c_str(), G_FILE_TEST_IS_REGULAR))
+    {
+        Logger::log("Input file %s not found", config_.inputFile_.c_str());
+        return nullptr;
+    }
+
+    std::vector<GstElement*> elements;
+    elements.push_back(gst_element_factory_make("filesrc", nullptr));
+    if (elements.back())
+    {
+        g_object_set(elements.back(), "location", config_.inputFile_.c_str(), nullptr);
+    }
+
+    const auto pcap = g_str_has_suffix(config_.inputFile_.c_str(), ".pcap");
+    if (pcap)
+    {
+        // Timestamps come from the capture, the UDP payload is the TS as udpsrc would have received it
+        elements.push_back(gst_element_factory_make("pcapparse", nullptr));
+        if (elements.back())
+        {
+            auto caps = gst_caps_new_simple("video/mpegts", "systemstream", G_TYPE_BOOLEAN, TRUE, nullptr);
+            g_object_set(elements.back(), "caps", caps, nullptr);
+            gst_caps_unref(caps);
+            if (config_.udpSourcePort_ != 0)
+            {
+                g_object_set(elements.back(), "dst-port", static_cast<gint>(config_.udpSourcePort_), nullptr);
+            }
+        }
+    }
+    else
+    {
+        // Timestamps from the PCR, they pace the replay and span the media duration in the summary
+        elements.push_back(gst_element_factory_make("tsparse", nullptr));
+        if (elements.back())
+        {
+            g_object_set(elements.back(), "set-timestamps", TRUE, nullptr);
+        }
+    }
+
+    if (!config_.inputFast_)
+    {
+        elements.push_back(gst_element_factory_make("clocksync", nullptr));
+    }
+
+    for (auto element : elements)
+    {
+        if (!element)
+        {
+            Logger::log("Unable to make input file elements");
+            return nullptr;
+        }
+        gst_bin_add(bin_, element);
+    }
+    for (size_t i = 1; i < elements.size(); ++i)
+    {
+        if (!gst_element_link(elements[i - 1], elements[i]))
+        {
+            Logger::log("Input file elements could not be linked.");
+            return nullptr;
+        }
+    }
+
+    utils::ScopedGLibObject srcPad(gst_element_get_static_pad(elements.back(), "src"));
+    gst_pad_add_probe(srcPad.get(), GST_PAD_PROBE_TYPE_BUFFER, inputProbe, this, nullptr);
+
+    Logger::log("Replaying %s %s %s",
+        pcap ? "pcap" : "TS file",
+        config_.inputFile_.c_str(),
+        config_.inputFast_ ? "as fast as possible" : pcap ? "at capture pace" : "paced by PCR");
+    return elements.back();
+}
+
+void FileSource::addOutput(GstElement* element, const std::string& name)
+{
+    outputs_.push_back(std::make_unique<Output>(this, name));
+    utils::ScopedGLibObject srcPad(gst_element_get_static_pad(element, "src"));
+    gst_pad_add_probe(srcPad.get(),
+        static_cast<GstPadProbeType>(
+            GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+        outputProbe,
+        outputs_.back().get(),
+        nullptr);
+}
+
+void FileSource::onInput(GstBuffer* buffer)
+{
+    if (startTime_ == 0)
+    {
+        startTime_ = g_get_monotonic_time();
+        startCpuTime_ = processCpuTimeUs();
+    }
+    bytesIn_ += gst_buffer_get_size(buffer);
+
+    if (GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        if (!GST_CLOCK_TIME_IS_VALID(firstTimestamp_))
+        {
+            firstTimestamp_ = GST_BUFFER_PTS(buffer);
+        }
+        lastTimestamp_ = GST_BUFFER_PTS(buffer);
+    }
+}
+
+void FileSource::onOutputEnded()
+{
+    // Outputs that never carried data, e.g. audio tracks without a stream, never see EOS either
+    for (const auto& output : outputs_)
+    {
+        if (output->packets_ != 0 && !output->ended_)
+        {
+            return;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(endMutex_);
+        if (summaryLogged_)
+        {
+            return;
+        }
+        summaryLogged_ = true;
+    }
+
+    logSummary();
+    if (endHandler_)
+    {
+        endHandler_();
+    }
+}
+
+void FileSource::logSummary()
+{
+    const auto wallSeconds = static_cast<double>(g_get_monotonic_time() - startTime_) / 1000000.0;
+    const auto cpuSeconds = static_cast<double>(processCpuTimeUs() - startCpuTime_) / 1000000.0;
+    const GstClockTime firstTimestamp = firstTimestamp_;
+    const GstClockTime lastTimestamp = lastTimestamp_;
+    const auto mediaSeconds = GST_CLOCK_TIME_IS_VALID(firstTimestamp) && lastTimestamp > firstTimestamp
+        ? static_cast<double>(lastTimestamp - firstTimestamp) / GST_SECOND
+        : 0.0;
+    const auto bytesIn = static_cast<double>(bytesIn_);
+
+    Logger::log("Input file ended: %.1f s media in %.2f s wall (%.2fx real time), %.2f s cpu (%.0f%% of wall), "
+                "%.2f Mbit/s in",
+        mediaSeconds,
+        wallSeconds,
+        wallSeconds > 0.0 ? mediaSeconds / wallSeconds : 0.0,
+        cpuSeconds,
+        wallSeconds > 0.0 ? cpuSeconds * 100.0 / wallSeconds : 0.0,
+        wallSeconds > 0.0 ? bytesIn * 8.0 / 1000000.0 / wallSeconds : 0.0);
+
+    for (const auto& output : outputs_)
+    {
+        const uint64_t packets = output->packets_;
+        const uint64_t bytes = output->bytes_;
+        Logger::log("Output %s: %llu RTP packets, %llu bytes, %.1f kbps of media",
+            output->name_.c_str(),
+            static_cast<unsigned long long>(packets),
+            static_cast<unsigned long long>(bytes),
+            mediaSeconds > 0.0 ? static_cast<double>(bytes) * 8.0 / 1000.0 / mediaSeconds : 0.0);
+    }
+}
+
+GstPadProbeReturn FileSource::inputProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    reinterpret_cast<FileSource*>(userData)->onInput(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn FileSource::outputProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto output = reinterpret_cast<Output*>(userData);
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+        if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_EOS && !output->ended_)
+        {
+            output->ended_ = true;
+            output->fileSource_->onOutputEnded();
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    uint64_t packets = 0;
+    output->bytes_ += bufferBytes(info, packets);
+    output->packets_ += packets;
+    return GST_PAD_PROBE_OK;
+}
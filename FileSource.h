@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <gst/gst.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct Config;
+
+/**
+ * Replays a recorded MPEG-TS file or a pcap capture of the UDP stream in place of the network source, to reproduce
+ * problems and get comparable CPU and throughput figures per content. Replay is paced either by the PCR of a TS file
+ * or the capture times of a pcap file, which behaves like the live source, or runs as fast as the pipeline takes the
+ * data. Bytes in and RTP packets and bytes out per output are counted, and a summary with wall time, process CPU time
+ * and the real-time factor is logged once every output that carried data has seen the end of the file.
+ */
+class FileSource
+{
+public:
+    using EndHandler = std::function<void()>;
+
+    FileSource(GstBin* bin, const Config& config, EndHandler endHandler);
+
+    GstElement* make();
+    void addOutput(GstElement* element, const std::string& name);
+
+private:
+    struct Output
+    {
+        Output(FileSource* fileSource, const std::string& name)
+            : fileSource_(fileSource),
+              name_(name),
+              packets_(0),
+              bytes_(0),
+              ended_(false)
+        {
+        }
+
+        FileSource* fileSource_;
+        std::string name_;
+        std::atomic<uint64_t> packets_;
+        std::atomic<uint64_t> bytes_;
+        std::atomic<bool> ended_;
+    };
+
+    GstBin* bin_;
+    const Config& config_;
+    EndHandler endHandler_;
+    std::vector<std::unique_ptr<Output>> outputs_;
+
+    std::atomic<uint64_t> bytesIn_;
+    std::atomic<gint64> startTime_;
+    std::atomic<gint64> startCpuTime_;
+    std::atomic<GstClockTime> firstTimestamp_;
+    std::atomic<GstClockTime> lastTimestamp_;
+
+    std::mutex endMutex_;
+    bool summaryLogged_;
+
+    void onInput(GstBuffer* buffer);
+    void onOutputEnded();
+    void logSummary();
+
+    static GstPadProbeReturn inputProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn outputProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+};
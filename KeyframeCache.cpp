@@ -0,0 +1,157 @@
+#include "KeyframeCache.h"
+#include "Logger.h"
+#include "utils/ScopedGLibObject.h"
+#include <gst/video/video.h>
+
+namespace
+{
+
+// Longer GOPs are not cached, replaying them in one frame interval would be a burst larger than the IDR itself
+const size_t maxCachedFrames = 120;
+
+} // namespace
+
+KeyframeCache::KeyframeCache(GstElement* parser, ReplayGate replayGate)
+    : srcPad_(gst_element_get_static_pad(parser, "src")),
+      probeId_(0),
+      replayGate_(std::move(replayGate)),
+      overflow_(false),
+      reordered_(false),
+      lastPts_(GST_CLOCK_TIME_NONE),
+      cached_(false),
+      replayPending_(false)
+{
+    buffers_.reserve(maxCachedFrames);
+    probeId_ = gst_pad_add_probe(srcPad_, GST_PAD_PROBE_TYPE_BUFFER, bufferProbe, this, nullptr);
+}
+
+KeyframeCache::~KeyframeCache()
+{
+    gst_pad_remove_probe(srcPad_, probeId_);
+    gst_object_unref(srcPad_);
+    clear();
+}
+
+bool KeyframeCache::requestReplay()
+{
+    if (!cached_)
+    {
+        return false;
+    }
+    replayPending_ = true;
+    return true;
+}
+
+void KeyframeCache::clear()
+{
+    for (auto buffer : buffers_)
+    {
+        gst_buffer_unref(buffer);
+    }
+    buffers_.clear();
+    overflow_ = false;
+    reordered_ = false;
+}
+
+void KeyframeCache::onBuffer(GstPad* pad, GstBuffer* buffer)
+{
+    const auto isKeyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    const auto pts = GST_BUFFER_PTS(buffer);
+
+    if (isKeyframe)
+    {
+        // The source's own key frame answers the request
+        replayPending_ = false;
+    }
+    else if (replayPending_.exchange(false))
+    {
+        if (!replayGate_())
+        {
+            requestUpstream(pad, "Video is gated, requesting a key frame upstream instead of replaying");
+        }
+        else if (!replay(pad, pts))
+        {
+            requestUpstream(pad, "No room to replay the cached key frame, requesting a key frame upstream");
+        }
+    }
+
+    if (isKeyframe)
+    {
+        clear();
+    }
+    if (!overflow_ && (isKeyframe || !buffers_.empty()))
+    {
+        if (buffers_.size() < maxCachedFrames)
+        {
+            // Frames in decode order that are not in display order can not get monotonic timestamps on replay
+            if (!buffers_.empty() &&
+                (!GST_CLOCK_TIME_IS_VALID(pts) || !GST_BUFFER_PTS_IS_VALID(buffers_.back()) ||
+                    pts <= GST_BUFFER_PTS(buffers_.back())))
+            {
+                reordered_ = true;
+            }
+            buffers_.push_back(gst_buffer_ref(buffer));
+        }
+        else
+        {
+            clear();
+            overflow_ = true;
+        }
+    }
+    cached_ = !buffers_.empty() && !reordered_;
+
+    if (!cached_ && replayPending_.exchange(false))
+    {
+        requestUpstream(pad, "Cached key frame dropped before its replay, requesting a key frame upstream");
+    }
+
+    if (GST_CLOCK_TIME_IS_VALID(pts) && (!GST_CLOCK_TIME_IS_VALID(lastPts_) || pts > lastPts_))
+    {
+        lastPts_ = pts;
+    }
+}
+
+bool KeyframeCache::replay(GstPad* pad, GstClockTime nextPts)
+{
+    if (buffers_.empty() || reordered_ || !GST_CLOCK_TIME_IS_VALID(lastPts_) || !GST_CLOCK_TIME_IS_VALID(nextPts) ||
+        nextPts <= lastPts_)
+    {
+        return false;
+    }
+
+    utils::ScopedGLibObject peerPad(gst_pad_get_peer(pad));
+    if (!peerPad.get())
+    {
+        return false;
+    }
+
+    // Spread the replayed frames between the previous and the next frame so timestamps stay monotonic
+    Logger::log("Replaying cached key frame and %zu following frames", buffers_.size() - 1);
+    const auto step = (nextPts - lastPts_) / (buffers_.size() + 1);
+    auto pts = lastPts_;
+    for (auto buffer : buffers_)
+    {
+        pts += step;
+        auto copy = gst_buffer_copy(buffer);
+        GST_BUFFER_PTS(copy) = pts;
+        GST_BUFFER_DTS(copy) = pts;
+        if (gst_pad_chain(peerPad.get(), copy) != GST_FLOW_OK)
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+void KeyframeCache::requestUpstream(GstPad* pad, const char* reason)
+{
+    Logger::log("%s", reason);
+    gst_pad_send_event(pad, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+}
+
+GstPadProbeReturn KeyframeCache::bufferProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData)
+{
+    auto keyframeCache = reinterpret_cast<KeyframeCache*>(userData);
+    keyframeCache->onBuffer(pad, GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
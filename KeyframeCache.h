@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <gst/gst.h>
+#include <vector>
+
+/**
+ * Keeps the last IDR frame and the frames following it as they leave a parser, so a key frame request can be answered
+ * without an encoder. On request the cached frames are replayed to the parser's peer just before the next frame,
+ * squeezed into one frame interval, which gives a joining or recovering receiver a decodable picture right away
+ * instead of at the next source GOP.
+ *
+ * Replayed frames get timestamps in decode order, so a GOP with reordered frames, e.g. B-frames, is not replayed.
+ * requestReplay() returns false when there is no such GOP cached, the request is then left to go upstream. The replay
+ * bypasses the probes on the parser's pad, the gate passed in says whether its frames may reach the payloader, e.g.
+ * not while the source is idle or the slate is shown. When a pending replay cannot be done, a key frame is requested
+ * upstream instead.
+ */
+class KeyframeCache
+{
+public:
+    using ReplayGate = std::function<bool()>;
+
+    KeyframeCache(GstElement* parser, ReplayGate replayGate);
+    ~KeyframeCache();
+
+    bool requestReplay();
+
+private:
+    GstPad* srcPad_;
+    gulong probeId_;
+    ReplayGate replayGate_;
+
+    std::vector<GstBuffer*> buffers_;
+    bool overflow_;
+    bool reordered_;
+    GstClockTime lastPts_;
+    std::atomic<bool> cached_;
+    std::atomic<bool> replayPending_;
+
+    void clear();
+    void onBuffer(GstPad* pad, GstBuffer* buffer);
+    bool replay(GstPad* pad, GstClockTime nextPts);
+    void requestUpstream(GstPad* pad, const char* reason);
+
+    static GstPadProbeReturn bufferProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData);
+};
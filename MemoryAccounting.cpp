@@ -0,0 +1,406 @@
+#include "MemoryAccounting.h"
+#include "Config.h"
+#include "Logger.h"
+#include "utils/Json.h"
+#include <algorithm>
+#include <fstream>
+#include <gst/video/video.h>
+#include <unistd.h>
+
+namespace
+{
+
+const guint checkIntervalMs = 1000;
+
+// The ingest queue gets its own limits back once the accounted total is this far below the budget
+const double budgetReleaseRatio = 0.8;
+
+// Ingest queue size while over budget, about a second of a 16 Mbit/s source
+const guint ingestLimitBytes = 2 * 1024 * 1024;
+
+// Holders listed in the log and the snapshot
+const size_t maxListedElements = 5;
+
+uint64_t readRssBytes()
+{
+    // Second field, resident pages
+    std::ifstream file("/proc/self/statm");
+    uint64_t sizePages = 0;
+    uint64_t residentPages = 0;
+    if (!(file >> sizePages >> residentPages))
+    {
+        return 0;
+    }
+    return residentPages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+void removeFrames(std::map<GstClockTime, gsize>& pending,
+    uint64_t& bytes,
+    std::map<GstClockTime, gsize>::iterator first,
+    std::map<GstClockTime, gsize>::iterator last)
+{
+    for (auto frame = first; frame != last; ++frame)
+    {
+        bytes -= frame->second;
+    }
+    pending.erase(first, last);
+}
+
+// What the pool allocates up front, it can grow beyond that up to its maximum
+uint64_t poolBytes(GstBufferPool* pool)
+{
+    if (!pool)
+    {
+        return 0;
+    }
+
+    uint64_t result = 0;
+    auto poolConfig = gst_buffer_pool_get_config(pool);
+    guint size = 0;
+    guint minBuffers = 0;
+    guint maxBuffers = 0;
+    if (gst_buffer_pool_config_get_params(poolConfig, nullptr, &size, &minBuffers, &maxBuffers))
+    {
+        result = static_cast<uint64_t>(size) * minBuffers;
+    }
+    gst_structure_free(poolConfig);
+    gst_object_unref(pool);
+    return result;
+}
+
+} // namespace
+
+MemoryAccounting::MemoryAccounting(GstBin* bin, GstElement* ingestQueue, const Config& config)
+    : bin_(bin),
+      ingestQueue_(ingestQueue),
+      budgetBytes_(static_cast<uint64_t>(config.memoryBudget_) * 1024 * 1024),
+      checkTimerId_(0),
+      overBudget_(false),
+      alarms_(0),
+      elementAddedId_(0),
+      elementRemovedId_(0),
+      ingestMaxSizeBytes_(0),
+      ingestLeaky_(0)
+{
+    elementAddedId_ = g_signal_connect(bin_, "deep-element-added", G_CALLBACK(elementAddedCallback), this);
+    elementRemovedId_ = g_signal_connect(bin_, "deep-element-removed", G_CALLBACK(elementRemovedCallback), this);
+
+    if (budgetBytes_ != 0)
+    {
+        checkTimerId_ = g_timeout_add(checkIntervalMs, checkTimerCallback, this);
+    }
+}
+
+MemoryAccounting::~MemoryAccounting()
+{
+    if (checkTimerId_ != 0)
+    {
+        g_source_remove(checkTimerId_);
+    }
+    g_signal_handler_disconnect(bin_, elementAddedId_);
+    g_signal_handler_disconnect(bin_, elementRemovedId_);
+
+    std::lock_guard<std::mutex> lock(codecsMutex_);
+    for (auto& codec : codecs_)
+    {
+        gst_pad_remove_probe(codec.second.sinkPad_, codec.second.sinkProbeId_);
+        gst_pad_remove_probe(codec.second.srcPad_, codec.second.srcProbeId_);
+        gst_object_unref(codec.second.sinkPad_);
+        gst_object_unref(codec.second.srcPad_);
+    }
+}
+
+MemoryAccounting::Usage MemoryAccounting::measure()
+{
+    Usage usage;
+    usage.rssBytes_ = readRssBytes();
+
+    auto iterator = gst_bin_iterate_elements(bin_);
+    GValue item = G_VALUE_INIT;
+    auto done = false;
+    while (!done)
+    {
+        switch (gst_iterator_next(iterator, &item))
+        {
+        case GST_ITERATOR_OK:
+        {
+            auto element = GST_ELEMENT(g_value_get_object(&item));
+            auto factory = gst_element_get_factory(element);
+            uint64_t bytes = 0;
+            if (factory && g_strcmp0(gst_plugin_feature_get_name(factory), "queue") == 0)
+            {
+                guint levelBytes = 0;
+                g_object_get(element, "current-level-bytes", &levelBytes, nullptr);
+                bytes = levelBytes;
+                usage.queueBytes_ += bytes;
+            }
+            else if (GST_IS_VIDEO_ENCODER(element))
+            {
+                // Frames in the lookahead and in the encoder's frame threads are still pending
+                bytes = codecBytes(element);
+                usage.codecBytes_ += bytes;
+            }
+            else if (GST_IS_VIDEO_DECODER(element))
+            {
+                const auto frames = codecBytes(element);
+                const auto pool = poolBytes(gst_video_decoder_get_buffer_pool(GST_VIDEO_DECODER(element)));
+                bytes = frames + pool;
+                usage.codecBytes_ += frames;
+                usage.poolBytes_ += pool;
+            }
+
+            if (bytes != 0)
+            {
+                usage.elements_.emplace_back(GST_ELEMENT_NAME(element), bytes);
+            }
+            g_value_reset(&item);
+            break;
+        }
+        case GST_ITERATOR_RESYNC:
+            usage = Usage();
+            usage.rssBytes_ = readRssBytes();
+            gst_iterator_resync(iterator);
+            break;
+        default:
+            done = true;
+            break;
+        }
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+
+    std::sort(usage.elements_.begin(),
+        usage.elements_.end(),
+        [](const std::pair<std::string, uint64_t>& lhs, const std::pair<std::string, uint64_t>& rhs)
+        { return lhs.second > rhs.second; });
+    return usage;
+}
+
+void MemoryAccounting::logReport()
+{
+    const auto usage = measure();
+    std::string holders;
+    for (size_t i = 0; i < std::min(usage.elements_.size(), maxListedElements); ++i)
+    {
+        holders.append(i == 0 ? "" : ", ");
+        holders.append(usage.elements_[i].first + " " + std::to_string(usage.elements_[i].second / 1024) + " KiB");
+    }
+
+    Logger::log("Memory: rss %llu MiB, accounted %llu KiB (queues %llu, codecs %llu, pools %llu)%s%s%s",
+        static_cast<unsigned long long>(usage.rssBytes_ / (1024 * 1024)),
+        static_cast<unsigned long long>(usage.total() / 1024),
+        static_cast<unsigned long long>(usage.queueBytes_ / 1024),
+        static_cast<unsigned long long>(usage.codecBytes_ / 1024),
+        static_cast<unsigned long long>(usage.poolBytes_ / 1024),
+        holders.empty() ? "" : ", top: ",
+        holders.c_str(),
+        overBudget_ ? ", OVER BUDGET" : "");
+}
+
+std::string MemoryAccounting::toJson()
+{
+    using utils::Json::field;
+    using utils::Json::quote;
+
+    const auto usage = measure();
+    std::string elements = "[";
+    for (size_t i = 0; i < std::min(usage.elements_.size(), maxListedElements); ++i)
+    {
+        elements.append(i == 0 ? "" : ",");
+        elements.append("{" + field("name", quote(usage.elements_[i].first)) + "," +
+            field("bytes", usage.elements_[i].second) + "}");
+    }
+    elements.append("]");
+
+    return "{" + field("rssBytes", usage.rssBytes_) + "," + field("accountedBytes", usage.total()) + "," +
+        field("queueBytes", usage.queueBytes_) + "," + field("codecBytes", usage.codecBytes_) + "," +
+        field("poolBytes", usage.poolBytes_) + "," + field("budgetBytes", budgetBytes_) + "," +
+        field("overBudget", overBudget_.load()) + "," + field("alarms", alarms_.load()) + "," +
+        field("elements", elements) + "}";
+}
+
+void MemoryAccounting::onCheckTimer()
+{
+    const auto usage = measure();
+    if (!overBudget_ && usage.total() > budgetBytes_)
+    {
+        overBudget_ = true;
+        ++alarms_;
+        Logger::log("Memory alarm: %llu KiB accounted, budget %llu KiB, largest %s, dropping at the ingest queue",
+            static_cast<unsigned long long>(usage.total() / 1024),
+            static_cast<unsigned long long>(budgetBytes_ / 1024),
+            usage.elements_.empty() ? "none" : usage.elements_.front().first.c_str());
+        setIngestLimit(true);
+    }
+    else if (overBudget_ && usage.total() < budgetBytes_ * budgetReleaseRatio)
+    {
+        overBudget_ = false;
+        Logger::log("Memory back to %llu KiB, budget %llu KiB, ingest queue limits restored",
+            static_cast<unsigned long long>(usage.total() / 1024),
+            static_cast<unsigned long long>(budgetBytes_ / 1024));
+        setIngestLimit(false);
+    }
+}
+
+void MemoryAccounting::setIngestLimit(bool limited)
+{
+    if (!limited)
+    {
+        g_object_set(ingestQueue_, "max-size-bytes", ingestMaxSizeBytes_, "leaky", ingestLeaky_, nullptr);
+        return;
+    }
+
+    // Leaky downstream drops the oldest data, what is left is the most recent part of the source
+    g_object_get(ingestQueue_, "max-size-bytes", &ingestMaxSizeBytes_, "leaky", &ingestLeaky_, nullptr);
+    g_object_set(ingestQueue_, "max-size-bytes", ingestLimitBytes, "leaky", 2, nullptr);
+}
+
+void MemoryAccounting::onElementAdded(GstElement* element)
+{
+    const auto decoder = GST_IS_VIDEO_DECODER(element);
+    if (!decoder && !GST_IS_VIDEO_ENCODER(element))
+    {
+        return;
+    }
+
+    Codec codec;
+    codec.frames_ = std::make_shared<CodecFrames>(decoder);
+    codec.sinkPad_ = gst_element_get_static_pad(element, "sink");
+    codec.srcPad_ = gst_element_get_static_pad(element, "src");
+    if (!codec.sinkPad_ || !codec.srcPad_)
+    {
+        Logger::log("Unable to account for the frames of %s", GST_ELEMENT_NAME(element));
+        if (codec.sinkPad_)
+        {
+            gst_object_unref(codec.sinkPad_);
+        }
+        if (codec.srcPad_)
+        {
+            gst_object_unref(codec.srcPad_);
+        }
+        return;
+    }
+
+    // Each probe keeps the counters alive until it is removed and no longer running
+    codec.sinkProbeId_ = gst_pad_add_probe(codec.sinkPad_,
+        static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_FLUSH),
+        codecInputProbe,
+        new std::shared_ptr<CodecFrames>(codec.frames_),
+        codecFramesDestroy);
+    codec.srcProbeId_ = gst_pad_add_probe(codec.srcPad_,
+        GST_PAD_PROBE_TYPE_BUFFER,
+        codecOutputProbe,
+        new std::shared_ptr<CodecFrames>(codec.frames_),
+        codecFramesDestroy);
+
+    std::lock_guard<std::mutex> lock(codecsMutex_);
+    codecs_[element] = codec;
+}
+
+void MemoryAccounting::onElementRemoved(GstElement* element)
+{
+    std::lock_guard<std::mutex> lock(codecsMutex_);
+    const auto findResult = codecs_.find(element);
+    if (findResult == codecs_.end())
+    {
+        return;
+    }
+
+    gst_pad_remove_probe(findResult->second.sinkPad_, findResult->second.sinkProbeId_);
+    gst_pad_remove_probe(findResult->second.srcPad_, findResult->second.srcProbeId_);
+    gst_object_unref(findResult->second.sinkPad_);
+    gst_object_unref(findResult->second.srcPad_);
+    codecs_.erase(findResult);
+}
+
+uint64_t MemoryAccounting::codecBytes(GstElement* element)
+{
+    std::shared_ptr<CodecFrames> frames;
+    {
+        std::lock_guard<std::mutex> lock(codecsMutex_);
+        const auto findResult = codecs_.find(element);
+        if (findResult == codecs_.cend())
+        {
+            return 0;
+        }
+        frames = findResult->second.frames_;
+    }
+
+    std::lock_guard<std::mutex> lock(frames->mutex_);
+    return frames->bytes_;
+}
+
+gboolean MemoryAccounting::checkTimerCallback(gpointer userData)
+{
+    reinterpret_cast<MemoryAccounting*>(userData)->onCheckTimer();
+    return G_SOURCE_CONTINUE;
+}
+
+void MemoryAccounting::elementAddedCallback(GstBin* /*bin*/,
+    GstBin* /*subBin*/,
+    GstElement* element,
+    gpointer userData)
+{
+    reinterpret_cast<MemoryAccounting*>(userData)->onElementAdded(element);
+}
+
+void MemoryAccounting::elementRemovedCallback(GstBin* /*bin*/,
+    GstBin* /*subBin*/,
+    GstElement* element,
+    gpointer userData)
+{
+    reinterpret_cast<MemoryAccounting*>(userData)->onElementRemoved(element);
+}
+
+GstPadProbeReturn MemoryAccounting::codecInputProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto& frames = **reinterpret_cast<std::shared_ptr<CodecFrames>*>(userData);
+    std::lock_guard<std::mutex> lock(frames.mutex_);
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_FLUSH)
+    {
+        if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_FLUSH_STOP)
+        {
+            frames.pending_.clear();
+            frames.bytes_ = 0;
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        auto& size = frames.pending_[GST_BUFFER_PTS(buffer)];
+        frames.bytes_ -= size;
+        size = gst_buffer_get_size(buffer);
+        frames.bytes_ += size;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn MemoryAccounting::codecOutputProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto& frames = **reinterpret_cast<std::shared_ptr<CodecFrames>*>(userData);
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    std::lock_guard<std::mutex> lock(frames.mutex_);
+
+    const auto findResult = frames.pending_.find(GST_BUFFER_PTS(buffer));
+    if (findResult != frames.pending_.end())
+    {
+        removeFrames(frames.pending_, frames.bytes_, findResult, std::next(findResult));
+    }
+
+    // A decoder outputs in PTS order and an encoder in DTS order with DTS <= PTS, so input older than that which is
+    // still pending was dropped and will not come out anymore
+    const auto oldest = frames.decoder_ ? GST_BUFFER_PTS(buffer) : GST_BUFFER_DTS(buffer);
+    if (GST_CLOCK_TIME_IS_VALID(oldest))
+    {
+        removeFrames(frames.pending_, frames.bytes_, frames.pending_.begin(), frames.pending_.lower_bound(oldest));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void MemoryAccounting::codecFramesDestroy(gpointer userData)
+{
+    delete reinterpret_cast<std::shared_ptr<CodecFrames>*>(userData);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <gst/gst.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct Config;
+
+/**
+ * Accounts for the memory one pipeline holds in media data: the bytes queued in every queue, the frames video
+ * decoders and encoders hold, including encoder lookahead and frame threads, and the buffers the decoder pools
+ * allocate up front. Process RSS is read next to it, for a process with several channels that is the sum of all of
+ * them. Codec frames are counted by probes on the codec pads as they go in and come out, asking the codec itself
+ * would take its stream lock on the main loop.
+ *
+ * With Config::memoryBudget_ set the accounted total is checked every second. Above the budget the ingest queue is
+ * capped and made leaky, so the source is dropped at the door instead of piling up downstream, and an alarm is
+ * logged and counted. Below budgetReleaseRatio of the budget the queue gets its own limits back.
+ */
+class MemoryAccounting
+{
+public:
+    struct Usage
+    {
+        Usage() : rssBytes_(0), queueBytes_(0), codecBytes_(0), poolBytes_(0) {}
+
+        uint64_t total() const { return queueBytes_ + codecBytes_ + poolBytes_; }
+
+        uint64_t rssBytes_;
+        uint64_t queueBytes_;
+        uint64_t codecBytes_;
+        uint64_t poolBytes_;
+        // Largest holders first, bytes per element
+        std::vector<std::pair<std::string, uint64_t>> elements_;
+    };
+
+    MemoryAccounting(GstBin* bin, GstElement* ingestQueue, const Config& config);
+    ~MemoryAccounting();
+
+    Usage measure();
+    void logReport();
+    std::string toJson();
+
+private:
+    struct CodecFrames
+    {
+        explicit CodecFrames(bool decoder) : decoder_(decoder), bytes_(0) {}
+
+        const bool decoder_;
+        std::mutex mutex_;
+        // Size of each frame that went in and has not come out yet, by PTS
+        std::map<GstClockTime, gsize> pending_;
+        uint64_t bytes_;
+    };
+
+    struct Codec
+    {
+        std::shared_ptr<CodecFrames> frames_;
+        GstPad* sinkPad_;
+        gulong sinkProbeId_;
+        GstPad* srcPad_;
+        gulong srcProbeId_;
+    };
+
+    GstBin* bin_;
+    GstElement* ingestQueue_;
+    const uint64_t budgetBytes_;
+    guint checkTimerId_;
+    std::atomic<bool> overBudget_;
+    std::atomic<uint64_t> alarms_;
+    gulong elementAddedId_;
+    gulong elementRemovedId_;
+    // Ingest queue properties before the limit was applied, restored when it is lifted
+    guint ingestMaxSizeBytes_;
+    gint ingestLeaky_;
+
+    // Codecs are added and removed by streaming threads, measured on the main loop
+    std::mutex codecsMutex_;
+    std::map<GstElement*, Codec> codecs_;
+
+    void onCheckTimer();
+    void setIngestLimit(bool limited);
+    void onElementAdded(GstElement* element);
+    void onElementRemoved(GstElement* element);
+    uint64_t codecBytes(GstElement* element);
+
+    static gboolean checkTimerCallback(gpointer userData);
+    static void elementAddedCallback(GstBin* bin, GstBin* subBin, GstElement* element, gpointer userData);
+    static void elementRemovedCallback(GstBin* bin, GstBin* subBin, GstElement* element, gpointer userData);
+    static GstPadProbeReturn codecInputProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn codecOutputProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData);
+    static void codecFramesDestroy(gpointer userData);
+};
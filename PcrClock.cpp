@@ -0,0 +1,155 @@
+#include "PcrClock.h"
+#include "Logger.h"
+#include "utils/TsPacket.h"
+#include <limits>
+
+namespace
+{
+
+// One observation per interval, the regression window then covers 128 x 250 ms = 32 s of stream
+const GstClockTime observationInterval = 250 * GST_MSECOND;
+const guint regressionWindowSize = 128;
+const guint regressionWindowThreshold = 8;
+
+// A larger PCR step is a discontinuity, bridged with the local time elapsed instead
+const GstClockTime maxPcrStep = GST_SECOND;
+
+GstClockTime pcrToTime(uint64_t pcr)
+{
+    return gst_util_uint64_scale(pcr, GST_SECOND, utils::TsPacket::pcrClockRate);
+}
+
+} // namespace
+
+PcrClock::PcrClock()
+    : pcrPid_(-1),
+      lastPcr_(0),
+      lastInternalTime_(GST_CLOCK_TIME_NONE),
+      masterTime_(0),
+      intervalStart_(GST_CLOCK_TIME_NONE),
+      bestOffset_(std::numeric_limits<GstClockTimeDiff>::max()),
+      bestInternalTime_(0),
+      bestMasterTime_(0)
+{
+    clock_ = GST_CLOCK(g_object_new(GST_TYPE_SYSTEM_CLOCK, "name", "pcr-clock", nullptr));
+    g_object_set(clock_,
+        "window-size",
+        regressionWindowSize,
+        "window-threshold",
+        regressionWindowThreshold,
+        nullptr);
+}
+
+PcrClock::~PcrClock()
+{
+    gst_object_unref(clock_);
+}
+
+void PcrClock::attach(GstPad* pad)
+{
+    gst_pad_add_probe(pad,
+        static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        bufferProbe,
+        this,
+        nullptr);
+}
+
+void PcrClock::onBuffer(GstBuffer* buffer)
+{
+    GstMapInfo mapInfo;
+    if (!gst_buffer_map(buffer, &mapInfo, GST_MAP_READ))
+    {
+        return;
+    }
+
+    auto offset = utils::TsPacket::findSync(mapInfo.data, mapInfo.size);
+    for (; offset + utils::TsPacket::size <= mapInfo.size; offset += utils::TsPacket::size)
+    {
+        const auto packet = mapInfo.data + offset;
+        uint64_t pcr;
+        if (packet[0] != utils::TsPacket::syncByte || !utils::TsPacket::pcr(packet, pcr))
+        {
+            continue;
+        }
+
+        // Lock on to the first PID carrying PCR, other programs run on their own clocks
+        const auto pid = utils::TsPacket::pid(packet);
+        if (pcrPid_ < 0)
+        {
+            Logger::log("Recovering clock from PCR on PID %u", pid);
+            pcrPid_ = pid;
+        }
+        if (pid == pcrPid_)
+        {
+            onPcr(pcr);
+        }
+    }
+
+    gst_buffer_unmap(buffer, &mapInfo);
+}
+
+void PcrClock::onPcr(uint64_t pcr)
+{
+    const auto internalTime = gst_clock_get_internal_time(clock_);
+
+    if (!GST_CLOCK_TIME_IS_VALID(lastInternalTime_))
+    {
+        masterTime_ = internalTime;
+    }
+    else
+    {
+        auto pcrStep = pcrToTime((pcr + utils::TsPacket::pcrWrap - lastPcr_) % utils::TsPacket::pcrWrap);
+        if (pcrStep > maxPcrStep)
+        {
+            Logger::log("PCR discontinuity, bridging with local time");
+            pcrStep = internalTime - lastInternalTime_;
+        }
+        masterTime_ += pcrStep;
+    }
+    lastPcr_ = pcr;
+    lastInternalTime_ = internalTime;
+
+    // Packets are only ever delayed by the network, the pair with the smallest offset is the least disturbed one
+    const auto offset = GST_CLOCK_DIFF(masterTime_, internalTime);
+    if (offset < bestOffset_)
+    {
+        bestOffset_ = offset;
+        bestInternalTime_ = internalTime;
+        bestMasterTime_ = masterTime_;
+    }
+
+    if (!GST_CLOCK_TIME_IS_VALID(intervalStart_))
+    {
+        intervalStart_ = internalTime;
+    }
+    if (internalTime - intervalStart_ < observationInterval)
+    {
+        return;
+    }
+
+    gdouble rSquared = 0;
+    gst_clock_add_observation(clock_, bestInternalTime_, bestMasterTime_, &rSquared);
+
+    intervalStart_ = internalTime;
+    bestOffset_ = std::numeric_limits<GstClockTimeDiff>::max();
+}
+
+GstPadProbeReturn PcrClock::bufferProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto pcrClock = reinterpret_cast<PcrClock*>(userData);
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        auto bufferList = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        for (guint i = 0; i < gst_buffer_list_length(bufferList); ++i)
+        {
+            pcrClock->onBuffer(gst_buffer_list_get(bufferList, i));
+        }
+    }
+    else
+    {
+        pcrClock->onBuffer(GST_PAD_PROBE_INFO_BUFFER(info));
+    }
+
+    return GST_PAD_PROBE_OK;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <gst/gst.h>
+
+/**
+ * Pipeline clock slaved to the PCR of the incoming MPEG-TS. Packets carrying a PCR are paired with the local arrival
+ * time, and the least delayed pair of each observation interval is fed to the clock's linear regression, so network
+ * jitter and bursts do not pull the estimate. Running the pipeline on this clock makes the output follow the rate of
+ * the source encoder instead of the local system clock, so long sessions do not drift.
+ */
+class PcrClock
+{
+public:
+    PcrClock();
+    ~PcrClock();
+
+    GstClock* getClock() const { return clock_; }
+    void attach(GstPad* pad);
+
+private:
+    GstClock* clock_;
+    int32_t pcrPid_;
+    uint64_t lastPcr_;
+    GstClockTime lastInternalTime_;
+    GstClockTime masterTime_;
+
+    GstClockTime intervalStart_;
+    GstClockTimeDiff bestOffset_;
+    GstClockTime bestInternalTime_;
+    GstClockTime bestMasterTime_;
+
+    void onBuffer(GstBuffer* buffer);
+    void onPcr(uint64_t pcr);
+
+    static GstPadProbeReturn bufferProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+};
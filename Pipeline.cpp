@@ -1,9 +1,26 @@
 #define GST_USE_UNSTABLE_API 1
 
 #include "Pipeline.h"
+#include "CaptionRelay.h"
 #include "Config.h"
+#include "EncoderBenchmark.h"
+#include "FileSource.h"
 #include "http/WhipClient.h"
+#include "KeyframeCache.h"
 #include "Logger.h"
+#include "MemoryAccounting.h"
+#include "PcrClock.h"
+#include "Recorder.h"
+#include "Restreamer.h"
+#include "RtpPacer.h"
+#include "Scte35Cues.h"
+#include "Slate.h"
+#include "SrtStatistics.h"
+#include "ThreadBudget.h"
+#include "TimedMetadata.h"
+#include "TracerStats.h"
+#include "VideoEncoder.h"
+#include "utils/Json.h"
 #include "utils/ScopedGLibMem.h"
 #include "utils/ScopedGLibObject.h"
 #include "utils/ScopedGstObject.h"
@@ -11,55 +28,171 @@
 #include <array>
 #include <atomic>
 #include <glib-unix.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/mpegts/mpegts.h>
 #include <gst/sdp/sdp.h>
+#include <gst/video/video.h>
 #include <gst/webrtc/webrtc.h>
 
-Pipeline::Pipeline(http::WhipClient& whipClient, const Config& config) : whipClient_(whipClient), config_(config)
+namespace
 {
-    gst_init(nullptr, nullptr);
 
-    pipeline_ = gst_pipeline_new("mpeg-ts-pipeline");
+GQuark bufferCountQuark()
+{
+    static const auto quark = g_quark_from_static_string("whip-mpegts-buffer-count");
+    return quark;
+}
 
-    makeElement(ElementLabel::VIDEO_CONVERT, "videoconvert");
+void deleteBufferCount(gpointer bufferCount)
+{
+    delete reinterpret_cast<std::atomic<uint64_t>*>(bufferCount);
+}
 
-    makeElement(ElementLabel::H264_PARSE, "h264parse");
-    makeElement(ElementLabel::H264_DECODE, "avdec_h264");
+GstPadProbeReturn countBuffersProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto bufferCount = reinterpret_cast<std::atomic<uint64_t>*>(userData);
+    const auto buffers = (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+        ? gst_buffer_list_length(GST_PAD_PROBE_INFO_BUFFER_LIST(info))
+        : 1;
+    bufferCount->fetch_add(buffers, std::memory_order_relaxed);
+    return GST_PAD_PROBE_OK;
+}
 
-    makeElement(ElementLabel::H265_PARSE, "h265parse");
-    makeElement(ElementLabel::H265_DECODE, "avdec_h265");
+const char* enumNick(GObject* object, const char* property)
+{
+    auto paramSpec = g_object_class_find_property(G_OBJECT_GET_CLASS(object), property);
+    if (!paramSpec || !G_IS_PARAM_SPEC_ENUM(paramSpec))
+    {
+        return "unknown";
+    }
 
-    makeElement(ElementLabel::MPEG2_PARSE, "mpegvideoparse");
-    makeElement(ElementLabel::MPEG2_DECODE, "avdec_mpeg2video");
+    gint value = 0;
+    g_object_get(object, property, &value, nullptr);
+    auto enumValue = g_enum_get_value(G_PARAM_SPEC_ENUM(paramSpec)->enum_class, value);
+    return enumValue ? enumValue->value_nick : "unknown";
+}
 
-    makeElement(ElementLabel::RTP_VIDEO_ENCODE, "x264enc");
-    makeElement(ElementLabel::RTP_VIDEO_PAYLOAD, "rtph264pay");
-    makeElement(ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE, "queue");
-    makeElement(ElementLabel::RTP_VIDEO_FILTER, "capsfilter");
+std::string currentCaps(GstElement* element)
+{
+    utils::ScopedGLibObject pad(gst_element_get_static_pad(element, "src"));
+    if (!pad.get())
+    {
+        return "";
+    }
+    utils::ScopedGstObject caps(gst_pad_get_current_caps(pad.get()));
+    if (!caps.get())
+    {
+        return "";
+    }
+    utils::ScopedGLibMem<gchar*> capsString(gst_caps_to_string(caps.get()));
+    return capsString.get();
+}
 
-    makeElement(ElementLabel::AAC_PARSE, "aacparse");
-    makeElement(ElementLabel::AAC_DECODE, "avdec_aac");
+// Buffers in a buffer or buffer list probe, counted the way queue levels count them
+uint64_t probeBufferCount(GstPadProbeInfo* info)
+{
+    return (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+        ? gst_buffer_list_length(GST_PAD_PROBE_INFO_BUFFER_LIST(info))
+        : 1;
+}
 
-    makeElement(ElementLabel::PCM_PARSE, "rawaudioparse");
+// Format identifier "Opus" of the registration descriptor, read big endian
+const guint32 opusRegistrationId = 0x4F707573;
 
-    makeElement(ElementLabel::OPUS_PARSE, "opusparse");
-    makeElement(ElementLabel::OPUS_DECODE, "opusdec");
+// Only stream types streamTypes_ has a decode branch for, MPEG-1/2 audio and AC-3 would end up in the AAC decoder
+bool isAudioStreamType(const GstMpegtsPMTStream* stream)
+{
+    switch (stream->stream_type)
+    {
+    case 0x0F: // AAC ADTS
+    case 0x11: // AAC LATM
+        return true;
+    case 0x06: // PES private data, Opus is told from AC-3, subtitles etc. by its registration descriptor
+    {
+        auto descriptor = gst_mpegts_find_descriptor(stream->descriptors, GST_MTS_DESC_REGISTRATION);
+        guint32 formatIdentifier = 0;
+        return descriptor &&
+            gst_mpegts_descriptor_parse_registration(descriptor, &formatIdentifier, nullptr, nullptr) &&
+            formatIdentifier == opusRegistrationId;
+    }
+    default:
+        return false;
+    }
+}
 
-    makeElement(ElementLabel::AUDIO_CONVERT, "audioconvert");
-    makeElement(ElementLabel::AUDIO_RESAMPLE, "audioresample");
-    makeElement(ElementLabel::RTP_AUDIO_ENCODE, "opusenc");
-    makeElement(ElementLabel::RTP_AUDIO_PAYLOAD, "rtpopuspay");
-    makeElement(ElementLabel::RTP_AUDIO_PAYLOAD_QUEUE, "queue");
-    makeElement(ElementLabel::RTP_AUDIO_FILTER, "capsfilter");
+// WHIP offer retries back off exponentially from the initial delay up to the maximum
+const std::chrono::milliseconds offerRetryInitialDelay(500);
+const std::chrono::milliseconds offerRetryMaxDelay(30000);
+
+// Source idle timeout used for the slate when --sourceIdleTimeout is not given
+const std::chrono::milliseconds slateDefaultIdleTimeout(1000);
+
+// Elements listed per stats interval with --tracers
+const size_t maxLoggedHotspots = 5;
+
+} // namespace
+
+// Parser first, then what it takes to get to raw media. Passthrough streams only use the parser.
+const std::vector<Pipeline::StreamType> Pipeline::streamTypes_ = {
+    {"video/x-h264", true, true, {"h264parse", "avdec_h264"}},
+    {"video/x-h265", true, false, {"h265parse", "avdec_h265"}},
+    {"video/mpeg", true, false, {"mpegvideoparse", "avdec_mpeg2video"}},
+    {"audio/mpeg", false, false, {"aacparse", "avdec_aac"}},
+    {"audio/x-opus", false, true, {"opusparse", "opusdec"}},
+    {"audio/x-raw", false, false, {"rawaudioparse"}}};
+
+Pipeline::Pipeline(http::WhipClient& whipClient, const Config& config)
+    : whipClient_(whipClient),
+      config_(config),
+      pipelineMessageBus_(nullptr),
+      pipeline_(nullptr),
+      statsTimerId_(0),
+      snapshotSignalId_(0),
+      srtLatency_(config.srtSourceLatency_),
+      srtLatencyTuned_(false),
+      srtPacketsReceived_(0),
+      lastKeyframeRequestTime_(0),
+      videoEncoder_(nullptr),
+      sourceEnded_(false),
+      offer_(nullptr),
+      offerRetryId_(0),
+      offerAttempts_(0),
+      offerRetryPending_(false),
+      encodingSuspended_(false),
+      idleTimerId_(0),
+      lastSourceActivity_(0),
+      sourceIdle_(false),
+      waitingForKeyframe_(false),
+      sourceBuffersQueued_(0),
+      staleSourceBuffers_(0),
+      dropStaleSourceData_(false)
+{
+    pipeline_ = gst_pipeline_new("mpeg-ts-pipeline");
+    gst_mpegts_initialize();
+    threadBudget_ = std::make_unique<ThreadBudget>(config_);
 
-    makeElement(ElementLabel::WEBRTC_BIN, "webrtcbin");
+    // Passthrough video is always H264
+    videoEncoder_ = VideoEncoder::find(config.bypass_video_ ? "x264" : config.videoEncoder_);
+    if (!videoEncoder_)
+    {
+        Logger::log("Unknown video encoder %s", config.videoEncoder_.c_str());
+        return;
+    }
 
-    if (config.showTimer_)
+    // Only the output side is made up front, the elements in front of the encoders are made per detected stream
+    if (config.video_)
     {
-        makeElement(ElementLabel::CLOCK_OVERLAY, "clockoverlay");
+        makeElement(ElementLabel::RTP_VIDEO_PAYLOAD, videoEncoder_->payloaderFactory_);
+        makeElement(ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE, "queue");
+        gst_element_link(getElement(ElementLabel::RTP_VIDEO_PAYLOAD),
+            getElement(ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE));
     }
 
+    makeElement(ElementLabel::WEBRTC_BIN, "webrtcbin");
+
     pipelineMessageBus_ = gst_pipeline_get_bus(GST_PIPELINE(pipeline_));
     gst_bus_add_watch(pipelineMessageBus_, reinterpret_cast<GstBusFunc>(pipelineBusWatch), pipeline_);
+    gst_bus_set_sync_handler(pipelineMessageBus_, busSyncHandler, this, nullptr);
 
     // Set up SIGHUP handler for pipeline debugging if GST_DEBUG_DUMP_DOT_DIR is set
     const char* dotDir = g_getenv("GST_DEBUG_DUMP_DOT_DIR");
@@ -69,21 +202,7 @@ Pipeline::Pipeline(http::WhipClient& whipClient, const Config& config) : whipCli
         Logger::log("SIGHUP signal handler installed - send SIGHUP to dump pipeline state (GST_DEBUG_DUMP_DOT_DIR=%s)", dotDir);
     }
 
-    if (!config_.bypass_video_)
-    {
-        g_object_set(elements_[ElementLabel::H264_PARSE], "disable-passthrough", TRUE, nullptr);
-    }
-
-    g_object_set(elements_[ElementLabel::RTP_VIDEO_ENCODE],
-        "threads",
-        2,
-        "bitrate",
-        config.h264encodeBitrate,
-        "tune",
-        1, // zerolatency
-        "speed-preset",
-        1, // ultrafast
-        nullptr);
+    snapshotSignalId_ = g_unix_signal_add(SIGUSR1, snapshotSignalCallback, this);
 
     if (config.audio_)
     {
@@ -99,9 +218,37 @@ Pipeline::Pipeline(http::WhipClient& whipClient, const Config& config) : whipCli
             "OPUS",
             nullptr));
 
-        gst_element_link_filtered(elements_[ElementLabel::RTP_AUDIO_PAYLOAD_QUEUE],
-            elements_[ElementLabel::WEBRTC_BIN],
-            rtpAudioFilterCaps.get());
+        utils::ScopedGstObject codecCaps(gst_caps_copy(rtpAudioFilterCaps.get()));
+        gst_caps_set_simple(codecCaps.get(),
+            "clock-rate",
+            G_TYPE_INT,
+            48000,
+            "encoding-params",
+            G_TYPE_STRING,
+            "2",
+            nullptr);
+
+        // One transceiver per audio track, all declared before the offer is made
+        for (uint32_t i = 0; i < std::max(config.audioTracks_, 1u); ++i)
+        {
+            AudioOutput audioOutput;
+            audioOutput.payloader_ = makeElement("rtpopuspay");
+            audioOutput.queue_ = makeElement("queue");
+            if (!audioOutput.payloader_ || !audioOutput.queue_ ||
+                !gst_element_link(audioOutput.payloader_, audioOutput.queue_) ||
+                !linkOutput(audioOutput.queue_, rtpAudioFilterCaps.get()))
+            {
+                Logger::log("Audio output %u could not be linked.", i);
+                break;
+            }
+
+            // Extra tracks may never get a stream, their transceivers must not wait for caps
+            if (config.fastStart_ || i > 0)
+            {
+                setCodecPreferences(codecCaps.get());
+            }
+            audioOutputs_.push_back(audioOutput);
+        }
     }
 
     if (config.video_)
@@ -115,15 +262,42 @@ Pipeline::Pipeline(http::WhipClient& whipClient, const Config& config) : whipCli
             96,
             "encoding-name",
             G_TYPE_STRING,
-            "H264",
+            videoEncoder_->encodingName_,
             nullptr));
 
-        gst_element_link_filtered(elements_[ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE],
-            elements_[ElementLabel::WEBRTC_BIN],
-            rtpVideoFilterCaps.get());
+        linkOutput(getElement(ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE), rtpVideoFilterCaps.get());
+
+        if (config.fastStart_)
+        {
+            utils::ScopedGstObject codecCaps(gst_caps_copy(rtpVideoFilterCaps.get()));
+            gst_caps_set_simple(codecCaps.get(), "clock-rate", G_TYPE_INT, 90000, nullptr);
+            if (g_strcmp0(videoEncoder_->encodingName_, "H264") == 0)
+            {
+                gst_caps_set_simple(codecCaps.get(), "packetization-mode", G_TYPE_STRING, "1", nullptr);
+            }
+            setCodecPreferences(codecCaps.get());
+        }
+
+        // RTCP PLI/FIR arrive from webrtcbin as upstream force key unit events
+        utils::ScopedGLibObject payloadSinkPad(
+            gst_element_get_static_pad(getElement(ElementLabel::RTP_VIDEO_PAYLOAD), "sink"));
+        gst_pad_add_probe(payloadSinkPad.get(),
+            GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+            videoUpstreamEventProbe,
+            this,
+            nullptr);
+
+        if (config.rtpPacing_ && config.lowLatency_)
+        {
+            Logger::log("RTP pacing is off in low-latency mode");
+        }
+        else if (config.rtpPacing_)
+        {
+            rtpPacer_ = std::make_unique<RtpPacer>(getElement(ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE));
+        }
     }
 
-    g_object_set(elements_[ElementLabel::WEBRTC_BIN],
+    g_object_set(getElement(ElementLabel::WEBRTC_BIN),
         "name",
         "send",
         "stun-server",
@@ -133,27 +307,118 @@ Pipeline::Pipeline(http::WhipClient& whipClient, const Config& config) : whipCli
         "latency",
         config.jitterBufferLatency_,
         nullptr);
-    gst_element_sync_state_with_parent(elements_[ElementLabel::WEBRTC_BIN]);
+    gst_element_sync_state_with_parent(getElement(ElementLabel::WEBRTC_BIN));
 
-    g_signal_connect(elements_[ElementLabel::WEBRTC_BIN],
+    // Data channels have to exist before the offer is made
+    if (config.scte35_)
+    {
+        makeDataChannel("scte35");
+    }
+    if (config.timedMetadata_)
+    {
+        makeDataChannel("metadata");
+        timedMetadata_ = std::make_unique<TimedMetadata>(getElement(ElementLabel::RTP_VIDEO_PAYLOAD),
+            [this](const std::string& message) { sendDataChannelMessage("metadata", message); });
+    }
+    if (config.captions_ == Config::CaptionMode::DATA_CHANNEL)
+    {
+        makeDataChannel("captions");
+    }
+    else if (config.captions_ == Config::CaptionMode::SEI && !config.bypass_video_ &&
+        g_strcmp0(videoEncoder_->name_, "x264") != 0)
+    {
+        Logger::log("Only x264 writes captions as SEI, %s output has none", videoEncoder_->name_);
+    }
+
+    g_signal_connect(getElement(ElementLabel::WEBRTC_BIN),
         "on-negotiation-needed",
         G_CALLBACK(onNegotiationNeededCallback),
         this);
-    g_signal_connect(elements_[ElementLabel::WEBRTC_BIN], "on-ice-candidate", G_CALLBACK(onIceCandidateCallback), this);
+    g_signal_connect(getElement(ElementLabel::WEBRTC_BIN),
+        "on-ice-candidate",
+        G_CALLBACK(onIceCandidateCallback),
+        this);
+    if (config.fastStart_)
+    {
+        g_signal_connect(getElement(ElementLabel::WEBRTC_BIN),
+            "notify::connection-state",
+            G_CALLBACK(onConnectionStateChangedCallback),
+            this);
+    }
 
     makeElement(ElementLabel::UDP_QUEUE, "queue");
     makeElement(ElementLabel::TS_DEMUX, "tsdemux");
-    if (!gst_element_link_many(elements_[ElementLabel::UDP_QUEUE], elements_[ElementLabel::TS_DEMUX], nullptr))
+    memoryAccounting_ =
+        std::make_unique<MemoryAccounting>(GST_BIN(pipeline_), getElement(ElementLabel::UDP_QUEUE), config_);
+    if (!gst_element_link_many(getElement(ElementLabel::UDP_QUEUE), getElement(ElementLabel::TS_DEMUX), nullptr))
     {
         g_printerr("UDP source elements could not be linked.\n");
         return;
     }
 
     GstElement* srcElement;
-    if (!config.srtTransport_)
+    if (!config.inputFile_.empty())
+    {
+        fileSource_ = std::make_unique<FileSource>(GST_BIN(pipeline_),
+            config_,
+            [this]()
+            {
+                if (endOfInputHandler_)
+                {
+                    endOfInputHandler_();
+                }
+            });
+        srcElement = fileSource_->make();
+        if (!srcElement)
+        {
+            return;
+        }
+
+        if (config.video_)
+        {
+            fileSource_->addOutput(getElement(ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE), "video");
+        }
+        for (size_t i = 0; i < audioOutputs_.size(); ++i)
+        {
+            fileSource_->addOutput(audioOutputs_[i].queue_, "audio" + std::to_string(i));
+        }
+    }
+    else if (config.applicationSource_)
+    {
+        // Data is pushed by the application, e.g. one SRT caller accepted by SrtListener. The caller's reader must not
+        // block, once max-bytes is queued the oldest data is dropped
+        makeElement(ElementLabel::APP_SOURCE, "appsrc");
+        utils::ScopedGstObject appSourceCaps(
+            gst_caps_new_simple("video/mpegts",
+                "systemstream",
+                G_TYPE_BOOLEAN,
+                TRUE,
+                "packetsize",
+                G_TYPE_INT,
+                188,
+                nullptr));
+        g_object_set(getElement(ElementLabel::APP_SOURCE),
+            "caps",
+            appSourceCaps.get(),
+            "is-live",
+            TRUE,
+            "do-timestamp",
+            TRUE,
+            "format",
+            GST_FORMAT_TIME,
+            "max-bytes",
+            static_cast<guint64>(8 * 1024 * 1024),
+            "block",
+            FALSE,
+            "leaky-type",
+            GST_APP_LEAKY_TYPE_DOWNSTREAM,
+            nullptr);
+        srcElement = getElement(ElementLabel::APP_SOURCE);
+    }
+    else if (!config.srtTransport_)
     {
         makeElement(ElementLabel::UDP_SOURCE, "udpsrc");
-        g_object_set(elements_[ElementLabel::UDP_SOURCE],
+        g_object_set(getElement(ElementLabel::UDP_SOURCE),
             "address",
             config.udpSourceAddress_.c_str(),
             "port",
@@ -163,7 +428,7 @@ Pipeline::Pipeline(http::WhipClient& whipClient, const Config& config) : whipCli
             "buffer-size",
             825984,
             nullptr);
-        srcElement = elements_[ElementLabel::UDP_SOURCE];
+        srcElement = getElement(ElementLabel::UDP_SOURCE);
     }
     else
     {
@@ -176,7 +441,7 @@ Pipeline::Pipeline(http::WhipClient& whipClient, const Config& config) : whipCli
             srtUri.append(":");
             srtUri.append(std::to_string(config.udpSourcePort_));
             Logger::log("SRT caller mode, connecting to %s", srtUri.c_str());
-            g_object_set(elements_[ElementLabel::SRT_SOURCE],
+            g_object_set(getElement(ElementLabel::SRT_SOURCE),
                 "uri",
                 srtUri.c_str(),
                 "mode",
@@ -192,7 +457,7 @@ Pipeline::Pipeline(http::WhipClient& whipClient, const Config& config) : whipCli
         else
         {
             // GST_SRT_CONNECTION_MODE_LISTENER (default)
-            g_object_set(elements_[ElementLabel::SRT_SOURCE],
+            g_object_set(getElement(ElementLabel::SRT_SOURCE),
                 "localaddress",
                 config.udpSourceAddress_.c_str(),
                 "localport",
@@ -207,501 +472,1608 @@ Pipeline::Pipeline(http::WhipClient& whipClient, const Config& config) : whipCli
                 true,
                 nullptr);
         }
-        srcElement = elements_[ElementLabel::SRT_SOURCE];
+        srcElement = getElement(ElementLabel::SRT_SOURCE);
     }
 
-    if (!config.restreamAddress_.empty())
+    if (!config.restreamDestinations_.empty() || (!config.recordDirectory_.empty() && config.recordSegments_ != 0))
     {
-        Logger::log("Restreaming (pass-through) to %s:%u srt=%s",
-            config.restreamAddress_.c_str(),
-            config.restreamPort_,
-            config.srtTransport_ ? "true" : "false");
         makeElement(ElementLabel::TEE, "tee");
-        makeElement(ElementLabel::RESTREAM_QUEUE, "queue");
-        if (!gst_element_link_many(srcElement,
-                elements_[ElementLabel::TEE],
-                elements_[ElementLabel::RESTREAM_QUEUE],
-                nullptr))
+        if (!gst_element_link(srcElement, getElement(ElementLabel::TEE)))
         {
-            Logger::log("Failed to connect to restream tee to restream queue.");
+            Logger::log("Failed to connect source to restream tee.");
             return;
         }
 
-        GstElement* restreamDestElement;
-        if (!config.srtTransport_)
-        {
-            makeElement(ElementLabel::UDP_DEST, "udpsink");
-            g_object_set(elements_[ElementLabel::UDP_DEST],
-                "host",
-                config.restreamAddress_.c_str(),
-                "port",
-                config.restreamPort_,
-                nullptr);
-
-            restreamDestElement = elements_[ElementLabel::UDP_DEST];
-        }
-        else
+        if (!config.restreamDestinations_.empty())
         {
-            makeElement(ElementLabel::SRT_DEST, "srtsink");
-            std::string restreamUri = "srt://";
-            restreamUri.append(config.restreamAddress_);
-            restreamUri.append(":");
-            restreamUri.append(std::to_string(config.restreamPort_));
-            Logger::log("SRT restream=%s", restreamUri.c_str());
-
-            g_object_set(elements_[ElementLabel::SRT_DEST],
-                "uri",
-                restreamUri.c_str(),
-                "mode",
-                1, // GST_SRT_CONNECTION_MODE_CALLER
-                "wait-for-connection",
-                false,
-                "latency",
-                config.srtSourceLatency_,
-                nullptr);
-
-            restreamDestElement = elements_[ElementLabel::SRT_DEST];
+            restreamer_ = std::make_unique<Restreamer>(GST_BIN(pipeline_), config_);
+            if (!restreamer_->link(getElement(ElementLabel::TEE)))
+            {
+                Logger::log("Restream destination elements could not be linked.");
+                return;
+            }
         }
 
-        if (!gst_element_link(elements_[ElementLabel::RESTREAM_QUEUE], restreamDestElement))
+        if (!config.recordDirectory_.empty() && config.recordSegments_ != 0)
         {
-            Logger::log("Restream destination elements could not be linked.");
-            return;
+            recorder_ = std::make_unique<Recorder>(GST_BIN(pipeline_), config_);
+            if (!recorder_->link(getElement(ElementLabel::TEE)))
+            {
+                recorder_.reset();
+            }
         }
 
-        srcElement = elements_[ElementLabel::TEE];
+        srcElement = getElement(ElementLabel::TEE);
     }
 
-    if (!gst_element_link(srcElement, elements_[ElementLabel::UDP_QUEUE]))
+    if (!gst_element_link(srcElement, getElement(ElementLabel::UDP_QUEUE)))
     {
         Logger::log("Failed to connect source with queue.");
         return;
     }
 
-    g_object_set(elements_[ElementLabel::TS_DEMUX], "latency", config.tsDemuxLatency_, nullptr);
-    g_object_set(elements_[ElementLabel::TS_DEMUX], "ignore-pcr", config_.ignorePcr_, nullptr);
-    g_signal_connect(elements_[ElementLabel::TS_DEMUX], "pad-added", G_CALLBACK(demuxPadAddedCallback), this);
-    g_signal_connect(elements_[ElementLabel::TS_DEMUX], "no-more-pads", G_CALLBACK(demuxNoMorePadsCallback), this);
+    g_object_set(getElement(ElementLabel::TS_DEMUX), "latency", config.tsDemuxLatency_, nullptr);
+    g_object_set(getElement(ElementLabel::TS_DEMUX), "ignore-pcr", config_.ignorePcr_, nullptr);
+    if (config.scte35_)
+    {
+        g_object_set(getElement(ElementLabel::TS_DEMUX), "send-scte35-events", TRUE, nullptr);
+    }
+    g_signal_connect(getElement(ElementLabel::TS_DEMUX), "pad-added", G_CALLBACK(demuxPadAddedCallback), this);
+    g_signal_connect(getElement(ElementLabel::TS_DEMUX), "pad-removed", G_CALLBACK(demuxPadRemovedCallback), this);
+    g_signal_connect(getElement(ElementLabel::TS_DEMUX), "no-more-pads", G_CALLBACK(demuxNoMorePadsCallback), this);
 
-    g_object_set(elements_[ElementLabel::UDP_QUEUE],
+    g_object_set(getElement(ElementLabel::UDP_QUEUE),
         "min-threshold-time",
         std::chrono::nanoseconds(config.udpSourceQueueMinTime_).count(),
         nullptr);
-}
-
-Pipeline::~Pipeline()
-{
-    gst_element_set_state(pipeline_, GST_STATE_NULL);
 
-    if (pipelineMessageBus_)
+    // The source and the queue thread that runs the demuxer, everything after them can wait a little
+    for (auto label :
+        {ElementLabel::UDP_SOURCE, ElementLabel::SRT_SOURCE, ElementLabel::APP_SOURCE, ElementLabel::UDP_QUEUE})
     {
-        gst_bus_remove_watch(pipelineMessageBus_);
-        gst_object_unref(pipelineMessageBus_);
+        auto element = getElement(label);
+        if (element)
+        {
+            ingestElements_.push_back(element);
+        }
     }
 
-    if (pipeline_)
+    // Only an EOS coming from the source ends the demuxed streams, the demuxer also sends one when a PMT drops a stream
+    utils::ScopedGLibObject udpQueueSinkPad(gst_element_get_static_pad(getElement(ElementLabel::UDP_QUEUE), "sink"));
+    gst_pad_add_probe(udpQueueSinkPad.get(), GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, sourceEosProbe, this, nullptr);
+
+    if (!config.slateFile_.empty())
     {
-        gst_object_unref(pipeline_);
+        makeSlate();
     }
 
-    gst_deinit();
-}
-
-void Pipeline::onDemuxPadAdded(GstPad* newPad)
-{
-    utils::ScopedGstObject newPadCaps(gst_pad_get_current_caps(newPad));
-    auto newPadStruct = gst_caps_get_structure(newPadCaps.get(), 0);
-    auto newPadType = gst_structure_get_name(newPadStruct);
-
-    Logger::log("Dynamic pad created, type %s", newPadType);
+    if (config_.sourceIdleTimeout_.count() != 0)
+    {
+        const auto bufferProbeType =
+            static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST);
+        gst_pad_add_probe(udpQueueSinkPad.get(), bufferProbeType, sourceActivityProbe, this, nullptr);
+        utils::ScopedGLibObject udpQueueSrcPad(gst_element_get_static_pad(getElement(ElementLabel::UDP_QUEUE), "src"));
+        gst_pad_add_probe(udpQueueSrcPad.get(), bufferProbeType, staleSourceDataProbe, this, nullptr);
+
+        const auto checkInterval = std::max<guint>(config_.sourceIdleTimeout_.count() / 4, 100);
+        idleTimerId_ = g_timeout_add(checkInterval, idleTimerCallback, this);
+    }
 
-    if (g_str_has_prefix(newPadType, "video/x-h264"))
+    if (config.pcrClockRecovery_)
     {
-        onH264SinkPadAdded(newPad);
+        pcrClock_ = std::make_unique<PcrClock>();
+        pcrClock_->attach(udpQueueSinkPad.get());
+        gst_pipeline_use_clock(GST_PIPELINE(pipeline_), pcrClock_->getClock());
     }
-    else if (g_str_has_prefix(newPadType, "video/x-h265"))
+
+    if (config.statsInterval_.count() != 0)
     {
-        onH265SinkPadAdded(newPad);
+        statsTimerId_ = g_timeout_add_seconds(config.statsInterval_.count(), statsTimerCallback, this);
     }
-    else if (g_str_has_prefix(newPadType, "video/mpeg"))
+}
+
+Pipeline::~Pipeline()
+{
+    if (statsTimerId_ != 0)
     {
-        onMpeg2SinkPadAdded(newPad);
+        g_source_remove(statsTimerId_);
     }
-    else if (g_str_has_prefix(newPadType, "audio/mpeg"))
+    if (snapshotSignalId_ != 0)
     {
-        onAacSinkPadAdded(newPad);
+        g_source_remove(snapshotSignalId_);
     }
-    else if (g_str_has_prefix(newPadType, "audio/x-opus"))
+    // A retry in flight may still schedule the next one
+    if (offerRetryThread_.joinable())
     {
-        onOpusSinkPadAdded(newPad);
+        offerRetryThread_.join();
     }
-    else if (g_str_has_prefix(newPadType, "audio/x-raw"))
+    if (offerRetryId_ != 0)
     {
-        onPcmSinkPadAdded(newPad);
+        g_source_remove(offerRetryId_);
     }
-    else
+    if (idleTimerId_ != 0)
     {
-        Logger::log("Unsupported MPEG-TS demux pad type %s", newPadType);
+        g_source_remove(idleTimerId_);
     }
-}
 
-void Pipeline::onDemuxNoMorePads()
-{
-    Logger::log("All pads created");
-    GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(pipeline_), GST_DEBUG_GRAPH_SHOW_ALL, "pipeline");
-}
+    // Stop their threads while the elements they use still exist
+    slate_.reset();
+    recorder_.reset();
 
-GstElement* Pipeline::addClockOverlay(GstElement* lastElement)
-{
-    if (config_.showTimer_ && !config_.bypass_video_)
+    gst_element_set_state(pipeline_, GST_STATE_NULL);
+
+    // Its probes and signal handlers are on the elements, which go with the pipeline
+    memoryAccounting_.reset();
+
+    for (auto& dataChannel : dataChannels_)
     {
-        if (!gst_element_link_many(lastElement, elements_[ElementLabel::CLOCK_OVERLAY], nullptr))
-        {
-            Logger::log("Video elements could not be linked.");
-            return lastElement;
-        }
-        lastElement = elements_[ElementLabel::CLOCK_OVERLAY];
+        g_object_unref(dataChannel.second);
     }
-    return lastElement;
-}
 
-void Pipeline::onH264SinkPadAdded(GstPad* newPad)
-{
-    const auto& findResult = elements_.find(ElementLabel::H264_PARSE);
-    if (findResult == elements_.cend())
+    for (auto& pendingPad : pendingPads_)
     {
-        return;
+        gst_object_unref(pendingPad.pad_);
     }
 
-    if (config_.bypass_video_)
+    if (offer_)
     {
-        if (!gst_element_link_many(elements_[ElementLabel::H264_PARSE],
-                elements_[ElementLabel::RTP_VIDEO_PAYLOAD],
-                elements_[ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE],
-                nullptr))
-        {
-            Logger::log("Video elements could not be linked.");
-            return;
-        }
+        gst_webrtc_session_description_free(offer_);
     }
-    else
-    {
-        if (!gst_element_link_many(elements_[ElementLabel::H264_PARSE], elements_[ElementLabel::H264_DECODE], nullptr))
-        {
-            Logger::log("Video elements could not be linked.");
-            return;
-        }
-
-        auto lastElement = elements_[ElementLabel::H264_DECODE];
-        lastElement = addClockOverlay(lastElement);
 
-        if (!gst_element_link_many(lastElement,
-                elements_[ElementLabel::VIDEO_CONVERT],
-                elements_[ElementLabel::RTP_VIDEO_ENCODE],
-                elements_[ElementLabel::RTP_VIDEO_PAYLOAD],
-                elements_[ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE],
-                nullptr))
-        {
-            Logger::log("Video elements could not be linked.");
-            return;
-        }
+    if (pipelineMessageBus_)
+    {
+        gst_bus_remove_watch(pipelineMessageBus_);
+        gst_object_unref(pipelineMessageBus_);
     }
 
-    utils::ScopedGLibObject sinkPad(gst_element_get_static_pad(findResult->second, "sink"));
-    if (gst_pad_is_linked(sinkPad.get()))
+    if (pipeline_)
     {
-        return;
+        gst_object_unref(pipeline_);
     }
-
-    gst_pad_link(newPad, sinkPad.get());
 }
 
-void Pipeline::onH265SinkPadAdded(GstPad* newPad)
+void Pipeline::makeSlate()
 {
-    const auto& findResult = elements_.find(ElementLabel::H265_PARSE);
-    if (findResult == elements_.cend())
+    // The slate is pre-encoded H264, other codecs would have to encode it
+    if (!config_.video_ || g_strcmp0(videoEncoder_->encodingName_, "H264") != 0)
     {
+        Logger::log("Slate needs H264 video output, not showing %s", config_.slateFile_.c_str());
         return;
     }
 
-    if (!gst_element_link_many(elements_[ElementLabel::H265_PARSE], elements_[ElementLabel::H265_DECODE], nullptr))
+    slate_ = std::make_unique<Slate>(config_.slateFile_);
+    if (!slate_->load())
     {
-        Logger::log("Video elements could not be linked.");
+        slate_.reset();
         return;
     }
 
-    auto lastElement = elements_[ElementLabel::H265_DECODE];
-    lastElement = addClockOverlay(lastElement);
-
-    if (!gst_element_link_many(lastElement,
-            elements_[ElementLabel::VIDEO_CONVERT],
-            elements_[ElementLabel::RTP_VIDEO_ENCODE],
-            elements_[ElementLabel::RTP_VIDEO_PAYLOAD],
-            elements_[ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE],
-            nullptr))
+    slate_->addOutput(getElement(ElementLabel::RTP_VIDEO_PAYLOAD), true);
+    for (const auto& audioOutput : audioOutputs_)
     {
-        Logger::log("Video elements could not be linked.");
-        return;
+        slate_->addOutput(audioOutput.payloader_, false);
     }
 
-    utils::ScopedGLibObject sinkPad(gst_element_get_static_pad(findResult->second, "sink"));
-    if (gst_pad_is_linked(sinkPad.get()))
+    // The slate takes over when the source is idle, that is also when decoding and encoding are parked
+    if (config_.sourceIdleTimeout_.count() == 0)
     {
-        return;
+        config_.sourceIdleTimeout_ = slateDefaultIdleTimeout;
     }
-
-    gst_pad_link(newPad, sinkPad.get());
 }
 
-void Pipeline::onMpeg2SinkPadAdded(GstPad* newPad)
+void Pipeline::onDemuxPadAdded(GstPad* newPad)
 {
-    const auto& findResult = elements_.find(ElementLabel::MPEG2_PARSE);
-    if (findResult == elements_.cend())
-    {
-        return;
-    }
-
-    if (!gst_element_link_many(elements_[ElementLabel::MPEG2_PARSE],
-            elements_[ElementLabel::MPEG2_DECODE],
-            elements_[ElementLabel::VIDEO_CONVERT],
-            elements_[ElementLabel::RTP_VIDEO_ENCODE],
-            elements_[ElementLabel::RTP_VIDEO_PAYLOAD],
-            elements_[ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE],
-            nullptr))
-    {
-        Logger::log("Video elements could not be linked.");
-        return;
-    }
+    // A demuxed stream ends with EOS when a PMT update removes it, that must not end the WHIP session
+    gst_pad_add_probe(newPad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, demuxEosProbe, this, nullptr);
 
-    utils::ScopedGLibObject sinkPad(gst_element_get_static_pad(findResult->second, "sink"));
-    if (gst_pad_is_linked(sinkPad.get()))
+    if (!linkDemuxPad(newPad, false))
     {
-        return;
+        // Data of streams that are not linked is dropped right at the demuxer, before any parsing or decoding
+        const auto probeId = gst_pad_add_probe(newPad, GST_PAD_PROBE_TYPE_BUFFER, dropProbe, nullptr, nullptr);
+        pendingPads_.push_back({GST_PAD(gst_object_ref(newPad)), probeId});
     }
-
-    gst_pad_link(newPad, sinkPad.get());
 }
 
-void Pipeline::onAacSinkPadAdded(GstPad* newPad)
+void Pipeline::onDemuxPadRemoved(GstPad* pad)
 {
-    const auto& findResult = elements_.find(ElementLabel::AAC_PARSE);
-    if (findResult == elements_.cend())
+    const auto pendingPad = std::find_if(pendingPads_.begin(),
+        pendingPads_.end(),
+        [pad](const PendingPad& pendingPad) { return pendingPad.pad_ == pad; });
+    if (pendingPad != pendingPads_.end())
     {
+        gst_object_unref(pendingPad->pad_);
+        pendingPads_.erase(pendingPad);
         return;
     }
 
-    if (!gst_element_link_many(elements_[ElementLabel::AAC_PARSE],
-            elements_[ElementLabel::AAC_DECODE],
-            elements_[ElementLabel::AUDIO_CONVERT],
-            elements_[ElementLabel::AUDIO_RESAMPLE],
-            elements_[ElementLabel::RTP_AUDIO_ENCODE],
-            elements_[ElementLabel::RTP_AUDIO_PAYLOAD],
-            elements_[ElementLabel::RTP_AUDIO_PAYLOAD_QUEUE],
-            nullptr))
+    const std::string padName = GST_PAD_NAME(pad);
+    const auto branch = std::find_if(streamBranches_.begin(),
+        streamBranches_.end(),
+        [&padName](const StreamBranch& branch) { return branch.padName_ == padName; });
+    if (branch == streamBranches_.end())
     {
-        Logger::log("Audio elements could not be linked.");
         return;
     }
 
-    utils::ScopedGLibObject sinkPad(gst_element_get_static_pad(findResult->second, "sink"));
-    if (gst_pad_is_linked(sinkPad.get()))
+    Logger::log("Demux pad %s removed, removing its %s branch", padName.c_str(), branch->video_ ? "video" : "audio");
+    if (!branch->video_)
     {
-        return;
+        std::lock_guard<std::mutex> lock(audioSelectionMutex_);
+        for (auto& audioOutput : audioOutputs_)
+        {
+            if (audioOutput.padName_ == padName)
+            {
+                audioOutput.padName_.clear();
+            }
+        }
     }
 
-    gst_pad_link(newPad, sinkPad.get());
+    // Unlinked from the shared tail once no buffer is passing, the elements are disposed of from the main loop
+    auto branchRemoval = new BranchRemoval{this, GST_BIN(gst_object_ref(pipeline_)), std::move(*branch)};
+    streamBranches_.erase(branch);
+
+    utils::ScopedGLibObject lastSrcPad(gst_element_get_static_pad(branchRemoval->branch_.elements_.back(), "src"));
+    gst_pad_add_probe(lastSrcPad.get(), GST_PAD_PROBE_TYPE_IDLE, unlinkBranchProbe, branchRemoval, nullptr);
 }
 
-void Pipeline::onPcmSinkPadAdded(GstPad* newPad)
+void Pipeline::linkPendingPads()
 {
-    const auto& findResult = elements_.find(ElementLabel::PCM_PARSE);
-    if (findResult == elements_.cend())
+    for (auto pendingPad = pendingPads_.begin(); pendingPad != pendingPads_.end();)
     {
-        return;
+        if (!linkDemuxPad(pendingPad->pad_, true))
+        {
+            ++pendingPad;
+            continue;
+        }
+
+        gst_pad_remove_probe(pendingPad->pad_, pendingPad->probeId_);
+        gst_object_unref(pendingPad->pad_);
+        pendingPad = pendingPads_.erase(pendingPad);
     }
+}
+
+bool Pipeline::linkDemuxPad(GstPad* newPad, bool replacing)
+{
+    utils::ScopedGstObject newPadCaps(gst_pad_get_current_caps(newPad));
+    auto newPadStruct = gst_caps_get_structure(newPadCaps.get(), 0);
+    auto newPadType = gst_structure_get_name(newPadStruct);
+
+    Logger::log("Dynamic pad %s, type %s", GST_PAD_NAME(newPad), newPadType);
 
-    if (!gst_element_link_many(elements_[ElementLabel::PCM_PARSE],
-            elements_[ElementLabel::AUDIO_CONVERT],
-            elements_[ElementLabel::AUDIO_RESAMPLE],
-            elements_[ElementLabel::RTP_AUDIO_ENCODE],
-            elements_[ElementLabel::RTP_AUDIO_PAYLOAD],
-            elements_[ElementLabel::RTP_AUDIO_PAYLOAD_QUEUE],
-            nullptr))
+    if (timedMetadata_ && TimedMetadata::isMetadata(newPadType))
     {
-        Logger::log("Audio elements could not be linked.");
-        return;
+        timedMetadata_->attach(newPad, newPadType);
+        return true;
     }
 
-    utils::ScopedGLibObject sinkPad(gst_element_get_static_pad(findResult->second, "sink"));
-    if (gst_pad_is_linked(sinkPad.get()))
+    const auto streamType = std::find_if(streamTypes_.cbegin(),
+        streamTypes_.cend(),
+        [newPadType](const StreamType& streamType) { return g_str_has_prefix(newPadType, streamType.capsPrefix_); });
+    if (streamType == streamTypes_.cend())
     {
-        return;
+        Logger::log("Unsupported MPEG-TS demux pad type %s", newPadType);
+        return false;
     }
 
-    gst_pad_link(newPad, sinkPad.get());
-}
-
-void Pipeline::onOpusSinkPadAdded(GstPad* newPad)
-{
-    const auto& findResult = elements_.find(ElementLabel::OPUS_PARSE);
-    if (findResult == elements_.cend())
+    if (streamType->video_ ? !config_.video_ : !config_.audio_)
     {
-        return;
+        Logger::log("Ignoring %s stream, %s is disabled", newPadType, streamType->video_ ? "video" : "audio");
+        return false;
     }
 
-    if (config_.bypass_audio_)
+    AudioOutput* audioOutput = nullptr;
+    if (streamType->video_)
     {
-        if (!gst_element_link_many(elements_[ElementLabel::OPUS_PARSE],
-                elements_[ElementLabel::RTP_AUDIO_PAYLOAD],
-                elements_[ElementLabel::RTP_AUDIO_PAYLOAD_QUEUE],
-                nullptr))
+        const auto existingBranch = std::find_if(streamBranches_.cbegin(),
+            streamBranches_.cend(),
+            [](const StreamBranch& branch) { return branch.video_; });
+        if (existingBranch != streamBranches_.cend())
         {
-            Logger::log("Audio elements could not be linked.");
-            return;
+            Logger::log("Holding back %s stream %s, video is taken by %s",
+                newPadType,
+                GST_PAD_NAME(newPad),
+                existingBranch->padName_.c_str());
+            return false;
         }
     }
     else
     {
-        if (!gst_element_link_many(elements_[ElementLabel::OPUS_PARSE],
-                elements_[ElementLabel::OPUS_DECODE],
-                elements_[ElementLabel::AUDIO_CONVERT],
-                elements_[ElementLabel::AUDIO_RESAMPLE],
-                elements_[ElementLabel::RTP_AUDIO_ENCODE],
-                elements_[ElementLabel::RTP_AUDIO_PAYLOAD],
-                elements_[ElementLabel::RTP_AUDIO_PAYLOAD_QUEUE],
-                nullptr))
+        audioOutput = selectAudioOutput(GST_PAD_NAME(newPad));
+        if (!audioOutput)
         {
-            Logger::log("Audio elements could not be linked.");
-            return;
+            return false;
         }
     }
 
-    utils::ScopedGLibObject sinkPad(gst_element_get_static_pad(findResult->second, "sink"));
-    if (gst_pad_is_linked(sinkPad.get()))
+    const auto passthrough =
+        streamType->passthroughAllowed_ && (streamType->video_ ? config_.bypass_video_ : config_.bypass_audio_);
+    if (!linkStreamBranch(newPad, *streamType, passthrough, audioOutput))
     {
-        return;
+        if (audioOutput)
+        {
+            std::lock_guard<std::mutex> lock(audioSelectionMutex_);
+            audioOutput->padName_.clear();
+        }
+        return false;
     }
 
-    gst_pad_link(newPad, sinkPad.get());
+    // The receiver's decoder has to start over on the new stream
+    if (replacing && streamType->video_)
+    {
+        requestKeyframe();
+    }
+    return true;
 }
 
-void Pipeline::onNegotiationNeeded()
+void Pipeline::onPmt(GstMpegtsSection* section)
 {
-    Logger::log("onNegotiationNeeded");
+    const auto pmt = gst_mpegts_section_get_pmt(section);
+    if (!pmt)
+    {
+        return;
+    }
 
-    GArray* transceivers;
-    g_signal_emit_by_name(elements_[ElementLabel::WEBRTC_BIN], "get-transceivers", &transceivers);
+    struct AudioTrack
+    {
+        uint16_t pid_;
+        std::string language_;
+        size_t rank_;
+    };
+    std::vector<AudioTrack> audioTracks;
 
-    for (uint32_t i = 0; i < transceivers->len; ++i)
+    for (guint i = 0; i < pmt->streams->len; ++i)
     {
-        auto transceiver = g_array_index(transceivers, GstWebRTCRTPTransceiver*, i);
-        if (g_object_class_find_property(G_OBJECT_GET_CLASS(transceiver), "direction") != nullptr)
+        auto stream = reinterpret_cast<GstMpegtsPMTStream*>(g_ptr_array_index(pmt->streams, i));
+
+        std::string language;
+        auto descriptor = gst_mpegts_find_descriptor(stream->descriptors, GST_MTS_DESC_ISO_639_LANGUAGE);
+        gchar* languageCode = nullptr;
+        if (descriptor && gst_mpegts_descriptor_parse_iso_639_language_idx(descriptor, 0, &languageCode, nullptr))
         {
-            g_object_set(transceiver, "direction", GST_WEBRTC_RTP_TRANSCEIVER_DIRECTION_SENDONLY, nullptr);
+            language = languageCode;
+            g_free(languageCode);
         }
-        g_object_set(transceiver, "fec-type", GST_WEBRTC_FEC_TYPE_NONE, nullptr);
-        g_object_set(transceiver, "do-nack", TRUE, nullptr);
+
+        if (!isAudioStreamType(stream))
+        {
+            continue;
+        }
+
+        const auto preference =
+            std::find(config_.audioLanguages_.cbegin(), config_.audioLanguages_.cend(), language);
+        const auto rank = static_cast<size_t>(preference - config_.audioLanguages_.cbegin());
+        audioTracks.push_back({stream->pid, language, rank});
     }
 
-    auto promise = gst_promise_new_with_change_func(onOfferCreatedCallback, this, nullptr);
-    g_signal_emit_by_name(elements_[ElementLabel::WEBRTC_BIN], "create-offer", nullptr, promise);
+    // Preferred languages first, otherwise in PMT order
+    std::stable_sort(audioTracks.begin(), audioTracks.end(), [](const AudioTrack& a, const AudioTrack& b) {
+        return a.rank_ < b.rank_;
+    });
+
+    std::lock_guard<std::mutex> lock(audioSelectionMutex_);
+    selectedAudioPids_.clear();
+    for (const auto& audioTrack : audioTracks)
+    {
+        const auto selected = selectedAudioPids_.size() < audioOutputs_.size();
+        Logger::log("Audio track PID 0x%04x language %s%s",
+            audioTrack.pid_,
+            audioTrack.language_.empty() ? "unknown" : audioTrack.language_.c_str(),
+            selected ? " (selected)" : "");
+        if (selected)
+        {
+            selectedAudioPids_.push_back(audioTrack.pid_);
+        }
+    }
 }
 
-void Pipeline::onOfferCreated(GstPromise* promise)
+void Pipeline::onStreamStatus(GstMessage* message)
 {
-    Logger::log("onOfferCreated");
+    GstStreamStatusType type;
+    GstElement* owner = nullptr;
+    gst_message_parse_stream_status(message, &type, &owner);
 
-    utils::ScopedGstObject<GstWebRTCSessionDescription> offer;
+    const auto ingest = std::find(ingestElements_.cbegin(), ingestElements_.cend(), owner) != ingestElements_.cend();
+    threadBudget_->onStreamStatus(type, owner, ingest);
+
+    auto tracerStats = TracerStats::get();
+    if (tracerStats && type == GST_STREAM_STATUS_TYPE_ENTER)
     {
-        GstWebRTCSessionDescription* offerPointer = nullptr;
-        const auto reply = gst_promise_get_reply(promise);
-        gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offerPointer, nullptr);
-        offer.set(offerPointer);
+        tracerStats->onThreadStarted(owner);
     }
-    gst_promise_unref(promise);
+}
 
-    utils::ScopedGLibMem offerGChar(gst_sdp_message_as_text(offer.get()->sdp));
+Pipeline::AudioOutput* Pipeline::selectAudioOutput(const std::string& padName)
+{
+    // tsdemux names its pads <type>_<program>_<pid in hex>
+    const auto pidSeparator = padName.rfind('_');
+    const auto pid = pidSeparator == std::string::npos ?
+        -1 :
+        static_cast<int32_t>(std::strtol(padName.c_str() + pidSeparator + 1, nullptr, 16));
+
+    std::lock_guard<std::mutex> lock(audioSelectionMutex_);
+
+    // Each selected track has its own output, in order of preference
+    if (!selectedAudioPids_.empty())
+    {
+        const auto findResult = std::find(selectedAudioPids_.cbegin(), selectedAudioPids_.cend(), pid);
+        if (findResult == selectedAudioPids_.cend())
+        {
+            Logger::log("Dropping unselected audio stream %s", padName.c_str());
+            return nullptr;
+        }
+
+        auto& audioOutput = audioOutputs_[findResult - selectedAudioPids_.cbegin()];
+        if (!audioOutput.padName_.empty())
+        {
+            Logger::log("Dropping audio stream %s, output in use by %s", padName.c_str(), audioOutput.padName_.c_str());
+            return nullptr;
+        }
+        audioOutput.padName_ = padName;
+        return &audioOutput;
+    }
+
+    // No PMT seen, the first streams get the outputs
+    for (auto& audioOutput : audioOutputs_)
+    {
+        if (audioOutput.padName_.empty())
+        {
+            audioOutput.padName_ = padName;
+            return &audioOutput;
+        }
+    }
+
+    Logger::log("Dropping audio stream %s, all %zu audio outputs in use", padName.c_str(), audioOutputs_.size());
+    return nullptr;
+}
+
+void Pipeline::onDemuxNoMorePads()
+{
+    Logger::log("All pads created");
+    GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(pipeline_), GST_DEBUG_GRAPH_SHOW_ALL, "pipeline");
+}
+
+bool Pipeline::linkStreamBranch(GstPad* newPad,
+    const StreamType& streamType,
+    bool passthrough,
+    AudioOutput* audioOutput)
+{
+    StreamBranch branch;
+    branch.padName_ = GST_PAD_NAME(newPad);
+    branch.video_ = streamType.video_;
+
+    // A passed through stream only needs its parser
+    const auto elementCount = passthrough ? 1 : streamType.elements_.size();
+    for (size_t i = 0; i < elementCount; ++i)
+    {
+        auto element = makeElement(streamType.elements_[i]);
+        if (!element)
+        {
+            discardStreamBranch(branch, false, audioOutput);
+            return false;
+        }
+        if (config_.decoderThreads_ != 0 && g_str_has_prefix(streamType.elements_[i], "avdec_"))
+        {
+            g_object_set(element, "max-threads", config_.decoderThreads_, nullptr);
+        }
+        branch.elements_.push_back(element);
+    }
+
+    auto parser = branch.elements_.front();
+    if (g_strcmp0(streamType.elements_.front(), "h264parse") == 0)
+    {
+        if (!passthrough)
+        {
+            g_object_set(parser, "disable-passthrough", TRUE, nullptr);
+        }
+        else
+        {
+            // Every IDR carries SPS/PPS, so a cached one can be replayed on its own
+            g_object_set(parser, "config-interval", -1, nullptr);
+            branch.keyframeCache_ = std::make_shared<KeyframeCache>(parser,
+                [this]()
+                {
+                    // The replay bypasses the video gate and the slate's switch back to the source
+                    return !encodingSuspended_ && !sourceIdle_ && !waitingForKeyframe_ &&
+                        !(slate_ && slate_->isActive());
+                });
+        }
+    }
+
+    if (streamType.video_ && config_.scte35_)
+    {
+        branch.scte35Cues_ = std::make_unique<Scte35Cues>(parser,
+            [this](const std::string& message) { sendDataChannelMessage("scte35", message); },
+            [this](GstClockTime runningTime) { return forceKeyframeAt(runningTime); });
+    }
+
+    // Parsing is cheap, everything after the parser only runs while there is a session and an active source
+    utils::ScopedGLibObject parserSrcPad(gst_element_get_static_pad(parser, "src"));
+    gst_pad_add_probe(parserSrcPad.get(),
+        GST_PAD_PROBE_TYPE_BUFFER,
+        streamType.video_ ? videoGateProbe : audioGateProbe,
+        this,
+        nullptr);
+
+    GstElement* tail;
+    if (passthrough)
+    {
+        tail = streamType.video_ ? getElement(ElementLabel::RTP_VIDEO_PAYLOAD) : audioOutput->payloader_;
+        unlinkSinkPad(tail);
+    }
+    else
+    {
+        tail = streamType.video_ ? makeVideoEncodeTail() : makeAudioEncodeTail(*audioOutput);
+    }
+    if (!tail)
+    {
+        Logger::log("%s elements could not be linked.", streamType.video_ ? "Video" : "Audio");
+        discardStreamBranch(branch, passthrough, audioOutput);
+        return false;
+    }
+
+    // Passed through video still has the captions in its SEI
+    if (streamType.video_ && config_.captions_ != Config::CaptionMode::OFF &&
+        (config_.captions_ == Config::CaptionMode::DATA_CHANNEL || !passthrough))
+    {
+        branch.captionRelay_ = std::make_unique<CaptionRelay>(parser,
+            config_.captions_,
+            [this](const std::string& message) { sendDataChannelMessage("captions", message); });
+        if (!passthrough)
+        {
+            branch.captionRelay_->attachEncoder(getElement(ElementLabel::RTP_VIDEO_ENCODE));
+        }
+    }
+
+    for (size_t i = 0; i < branch.elements_.size(); ++i)
+    {
+        auto next = i + 1 < branch.elements_.size() ? branch.elements_[i + 1] : tail;
+        if (!gst_element_link(branch.elements_[i], next))
+        {
+            Logger::log("%s elements could not be linked.", streamType.video_ ? "Video" : "Audio");
+            discardStreamBranch(branch, passthrough, audioOutput);
+            return false;
+        }
+    }
+
+    // Downstream first, so nothing is pushed into an element that is not running yet
+    for (auto element = branch.elements_.rbegin(); element != branch.elements_.rend(); ++element)
+    {
+        gst_element_sync_state_with_parent(*element);
+    }
+
+    utils::ScopedGLibObject sinkPad(gst_element_get_static_pad(parser, "sink"));
+    if (gst_pad_link(newPad, sinkPad.get()) != GST_PAD_LINK_OK)
+    {
+        Logger::log("Unable to link demux pad %s", branch.padName_.c_str());
+        discardStreamBranch(branch, passthrough, audioOutput);
+        return false;
+    }
+
+    Logger::log("Linked %s stream %s%s",
+        streamType.video_ ? "video" : "audio",
+        branch.padName_.c_str(),
+        passthrough ? " (passthrough)" : "");
+    if (branch.keyframeCache_)
+    {
+        std::lock_guard<std::mutex> lock(keyframeCacheMutex_);
+        keyframeCache_ = branch.keyframeCache_;
+    }
+    streamBranches_.push_back(std::move(branch));
+    return true;
+}
+
+void Pipeline::discardStreamBranch(StreamBranch& branch, bool passthrough, AudioOutput* audioOutput)
+{
+    // Nothing has been pushed into the branch, it can go right away. Removing an element unlinks its pads
+    releaseBranchProbes(branch);
+    for (auto element : branch.elements_)
+    {
+        gst_element_set_state(element, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(pipeline_), element);
+    }
+    branch.elements_.clear();
+
+    if (!passthrough)
+    {
+        return;
+    }
+
+    // The payloader was cut off its encoder for the passed through stream, a transcoded one can use it again
+    auto encoder = branch.video_ ? getElement(ElementLabel::RTP_VIDEO_ENCODE) : audioOutput->encoder_;
+    auto payloader = branch.video_ ? getElement(ElementLabel::RTP_VIDEO_PAYLOAD) : audioOutput->payloader_;
+    if (encoder && payloader && !relinkToPayloader(encoder, payloader))
+    {
+        Logger::log("Unable to relink the %s encoder to its payloader", branch.video_ ? "video" : "audio");
+    }
+}
+
+void Pipeline::releaseBranchProbes(StreamBranch& branch)
+{
+    if (branch.keyframeCache_)
+    {
+        std::lock_guard<std::mutex> lock(keyframeCacheMutex_);
+        if (keyframeCache_ == branch.keyframeCache_)
+        {
+            keyframeCache_.reset();
+        }
+    }
+    branch.keyframeCache_.reset();
+    branch.scte35Cues_.reset();
+    branch.captionRelay_.reset();
+}
+
+GstElement* Pipeline::makeVideoEncodeTail()
+{
+    auto videoConvert = getElement(ElementLabel::VIDEO_CONVERT);
+    if (videoConvert)
+    {
+        // The payloader may have been fed by a passed through stream in the meantime
+        if (!relinkToPayloader(getElement(ElementLabel::RTP_VIDEO_ENCODE), getElement(ElementLabel::RTP_VIDEO_PAYLOAD)))
+        {
+            return nullptr;
+        }
+        auto clockOverlay = getElement(ElementLabel::CLOCK_OVERLAY);
+        return clockOverlay ? clockOverlay : videoConvert;
+    }
+
+    std::vector<GstElement*> tail;
+
+    if (config_.showTimer_)
+    {
+        makeElement(ElementLabel::CLOCK_OVERLAY, "clockoverlay");
+        tail.push_back(getElement(ElementLabel::CLOCK_OVERLAY));
+    }
+
+    makeElement(ElementLabel::VIDEO_CONVERT, "videoconvert");
+    tail.push_back(getElement(ElementLabel::VIDEO_CONVERT));
+
+    // The benchmark encoders see exactly the frames the real encoder gets
+    if (config_.videoEncoderBenchmark_)
+    {
+        makeElement(ElementLabel::VIDEO_TEE, "tee");
+        tail.push_back(getElement(ElementLabel::VIDEO_TEE));
+        encoderBenchmark_ = std::make_unique<EncoderBenchmark>(GST_BIN(pipeline_), config_);
+    }
+
+    makeElement(ElementLabel::RTP_VIDEO_ENCODE, videoEncoder_->encoderFactory_);
+    videoEncoder_->configure_(getElement(ElementLabel::RTP_VIDEO_ENCODE),
+        config_.h264encodeBitrate,
+        config_.encoderThreads_);
+    if (config_.lowLatency_)
+    {
+        if (videoEncoder_->configureLowLatency_)
+        {
+            videoEncoder_->configureLowLatency_(getElement(ElementLabel::RTP_VIDEO_ENCODE));
+        }
+        else
+        {
+            Logger::log("No low-latency settings for %s, using its defaults", videoEncoder_->name_);
+        }
+    }
+    tail.push_back(getElement(ElementLabel::RTP_VIDEO_ENCODE));
+
+    auto first = linkEncodeTail(tail, getElement(ElementLabel::RTP_VIDEO_PAYLOAD));
+    if (first && encoderBenchmark_ && !encoderBenchmark_->link(getElement(ElementLabel::VIDEO_TEE)))
+    {
+        return nullptr;
+    }
+    return first;
+}
+
+bool Pipeline::insertClockOverlay()
+{
+    makeElement(ElementLabel::CLOCK_OVERLAY, "clockoverlay");
+    auto clockOverlay = getElement(ElementLabel::CLOCK_OVERLAY);
+    if (!clockOverlay)
+    {
+        std::lock_guard<std::mutex> lock(elementsMutex_);
+        elements_.erase(ElementLabel::CLOCK_OVERLAY);
+        return false;
+    }
+
+    utils::ScopedGLibObject convertSinkPad(
+        gst_element_get_static_pad(getElement(ElementLabel::VIDEO_CONVERT), "sink"));
+    utils::ScopedGLibObject decoderSrcPad(gst_pad_get_peer(convertSinkPad.get()));
+    if (!decoderSrcPad.get())
+    {
+        // No video stream linked right now, the next one is linked to the overlay
+        if (!gst_element_link(clockOverlay, getElement(ElementLabel::VIDEO_CONVERT)))
+        {
+            return false;
+        }
+        gst_element_sync_state_with_parent(clockOverlay);
+        return true;
+    }
+
+    // Spliced in between two frames, the encoder and the WHIP session keep running
+    gst_pad_add_probe(decoderSrcPad.get(), GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, insertClockOverlayProbe, this, nullptr);
+    return true;
+}
+
+GstElement* Pipeline::makeAudioEncodeTail(AudioOutput& audioOutput)
+{
+    if (audioOutput.encodeTail_)
+    {
+        return relinkToPayloader(audioOutput.encoder_, audioOutput.payloader_) ? audioOutput.encodeTail_ : nullptr;
+    }
+
+    audioOutput.encoder_ = makeElement("opusenc");
+    audioOutput.encodeTail_ =
+        linkEncodeTail({makeElement("audioconvert"), makeElement("audioresample"), audioOutput.encoder_},
+            audioOutput.payloader_);
+    return audioOutput.encodeTail_;
+}
+
+void Pipeline::unlinkSinkPad(GstElement* element)
+{
+    utils::ScopedGLibObject sinkPad(gst_element_get_static_pad(element, "sink"));
+    utils::ScopedGLibObject peerPad(gst_pad_get_peer(sinkPad.get()));
+    if (peerPad.get())
+    {
+        gst_pad_unlink(peerPad.get(), sinkPad.get());
+    }
+}
+
+bool Pipeline::relinkToPayloader(GstElement* encoder, GstElement* payloader)
+{
+    utils::ScopedGLibObject encoderSrcPad(gst_element_get_static_pad(encoder, "src"));
+    if (gst_pad_is_linked(encoderSrcPad.get()))
+    {
+        return true;
+    }
+
+    unlinkSinkPad(payloader);
+    return gst_element_link(encoder, payloader);
+}
+
+GstElement* Pipeline::linkEncodeTail(const std::vector<GstElement*>& tail, GstElement* payloader)
+{
+    for (size_t i = 0; i < tail.size(); ++i)
+    {
+        if (!tail[i] || !gst_element_link(tail[i], i + 1 < tail.size() ? tail[i + 1] : payloader))
+        {
+            return nullptr;
+        }
+    }
+
+    for (auto element = tail.rbegin(); element != tail.rend(); ++element)
+    {
+        gst_element_sync_state_with_parent(*element);
+    }
+    return tail.front();
+}
+
+void Pipeline::setCodecPreferences(GstCaps* rtpCaps)
+{
+    // With codec preferences webrtcbin can create the offer without waiting for caps on its sink pad
+    GArray* transceivers;
+    g_signal_emit_by_name(getElement(ElementLabel::WEBRTC_BIN), "get-transceivers", &transceivers);
+    if (transceivers->len == 0)
+    {
+        Logger::log("No transceiver to set codec preferences on");
+        g_array_unref(transceivers);
+        return;
+    }
+
+    // The transceiver of the pad linked last
+    auto transceiver = g_array_index(transceivers, GstWebRTCRTPTransceiver*, transceivers->len - 1);
+    g_object_set(transceiver, "codec-preferences", rtpCaps, nullptr);
+    g_array_unref(transceivers);
+}
+
+void Pipeline::requestKeyframe()
+{
+    auto payloader = getElement(ElementLabel::RTP_VIDEO_PAYLOAD);
+    if (!config_.video_ || !payloader)
+    {
+        return;
+    }
+
+    // Takes the same path as RTCP PLI/FIR from webrtcbin, see onVideoUpstreamEvent
+    utils::ScopedGLibObject payloadSrcPad(gst_element_get_static_pad(payloader, "src"));
+    gst_pad_send_event(payloadSrcPad.get(), gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+}
+
+bool Pipeline::forceKeyframeAt(GstClockTime runningTime)
+{
+    auto encoder = getElement(ElementLabel::RTP_VIDEO_ENCODE);
+    if (!encoder)
+    {
+        Logger::log("No encoder, passed through video keeps its GOP structure");
+        return false;
+    }
+
+    // The encoder keeps the request until the first frame at or after the running time
+    utils::ScopedGLibObject encoderSinkPad(gst_element_get_static_pad(encoder, "sink"));
+    return gst_pad_send_event(encoderSinkPad.get(),
+        gst_video_event_new_downstream_force_key_unit(GST_CLOCK_TIME_NONE,
+            GST_CLOCK_TIME_NONE,
+            runningTime,
+            TRUE,
+            0));
+}
+
+bool Pipeline::linkOutput(GstElement* queue, GstCaps* rtpCaps)
+{
+    if (!config_.fakeOutput_)
+    {
+        return gst_element_link_filtered(queue, getElement(ElementLabel::WEBRTC_BIN), rtpCaps);
+    }
+
+    // Benchmarks measure the pipeline up to the payloaders, the RTP packets are thrown away as fast as they come
+    auto fakeSink = makeElement("fakesink");
+    if (!fakeSink)
+    {
+        return false;
+    }
+    g_object_set(fakeSink, "sync", FALSE, "async", FALSE, nullptr);
+    return gst_element_link_filtered(queue, fakeSink, rtpCaps);
+}
+
+void Pipeline::makeDataChannel(const char* label)
+{
+    GstWebRTCDataChannel* dataChannel = nullptr;
+    auto options = gst_structure_new("data-channel-options", "ordered", G_TYPE_BOOLEAN, TRUE, nullptr);
+    g_signal_emit_by_name(getElement(ElementLabel::WEBRTC_BIN), "create-data-channel", label, options, &dataChannel);
+    gst_structure_free(options);
+    if (!dataChannel)
+    {
+        Logger::log("Unable to create data channel %s", label);
+        return;
+    }
+    dataChannels_[label] = dataChannel;
+}
+
+bool Pipeline::sendDataChannelMessage(const std::string& label, const std::string& message)
+{
+    const auto findResult = dataChannels_.find(label);
+    if (findResult == dataChannels_.cend())
+    {
+        return false;
+    }
+
+    // Messages are only meaningful live, nothing is queued until the channel opens
+    GstWebRTCDataChannelState state = GST_WEBRTC_DATA_CHANNEL_STATE_CLOSED;
+    g_object_get(findResult->second, "ready-state", &state, nullptr);
+    if (state != GST_WEBRTC_DATA_CHANNEL_STATE_OPEN)
+    {
+        return false;
+    }
+
+    gst_webrtc_data_channel_send_string(findResult->second, message.c_str());
+    return true;
+}
+
+GstPadProbeReturn Pipeline::onVideoUpstreamEvent(GstEvent* event)
+{
+    if (!gst_video_event_is_force_key_unit(event))
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Coalesce bursts of PLI/FIR, e.g. from several viewers joining at once
+    const auto now = g_get_monotonic_time();
+    auto lastRequestTime = lastKeyframeRequestTime_.load();
+    if ((lastRequestTime != 0 &&
+            now - lastRequestTime < std::chrono::microseconds(config_.keyframeMinInterval_).count()) ||
+        !lastKeyframeRequestTime_.compare_exchange_strong(lastRequestTime, now))
+    {
+        return GST_PAD_PROBE_DROP;
+    }
+
+    std::shared_ptr<KeyframeCache> keyframeCache;
+    {
+        std::lock_guard<std::mutex> lock(keyframeCacheMutex_);
+        keyframeCache = keyframeCache_;
+    }
+    if (keyframeCache && keyframeCache->requestReplay())
+    {
+        Logger::log("Key frame requested, replaying cached key frame");
+        return GST_PAD_PROBE_DROP;
+    }
+
+    Logger::log("Key frame requested from encoder");
+    return GST_PAD_PROBE_OK;
+}
+
+void Pipeline::onNegotiationNeeded()
+{
+    Logger::log("onNegotiationNeeded");
+    if (config_.fakeOutput_)
+    {
+        Logger::log("Fake output, no WHIP session");
+        return;
+    }
+
+    GArray* transceivers;
+    g_signal_emit_by_name(getElement(ElementLabel::WEBRTC_BIN), "get-transceivers", &transceivers);
+
+    for (uint32_t i = 0; i < transceivers->len; ++i)
+    {
+        auto transceiver = g_array_index(transceivers, GstWebRTCRTPTransceiver*, i);
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(transceiver), "direction") != nullptr)
+        {
+            g_object_set(transceiver, "direction", GST_WEBRTC_RTP_TRANSCEIVER_DIRECTION_SENDONLY, nullptr);
+        }
+        g_object_set(transceiver, "fec-type", GST_WEBRTC_FEC_TYPE_NONE, nullptr);
+        g_object_set(transceiver, "do-nack", TRUE, nullptr);
+    }
+
+    auto promise = gst_promise_new_with_change_func(onOfferCreatedCallback, this, nullptr);
+    g_signal_emit_by_name(getElement(ElementLabel::WEBRTC_BIN), "create-offer", nullptr, promise);
+}
+
+void Pipeline::onOfferCreated(GstPromise* promise)
+{
+    Logger::log("onOfferCreated");
+
+    utils::ScopedGstObject<GstWebRTCSessionDescription> offer;
+    {
+        GstWebRTCSessionDescription* offerPointer = nullptr;
+        const auto reply = gst_promise_get_reply(promise);
+        gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offerPointer, nullptr);
+        offer.set(offerPointer);
+    }
+    gst_promise_unref(promise);
+
+    // A renegotiated offer replaces one still waiting for a retry
+    std::lock_guard<std::mutex> lock(offerMutex_);
+    if (offerRetryId_ != 0)
+    {
+        g_source_remove(offerRetryId_);
+        offerRetryId_ = 0;
+    }
+    offerRetryPending_ = false;
+    if (offer_)
+    {
+        gst_webrtc_session_description_free(offer_);
+    }
+    offer_ = gst_webrtc_session_description_copy(offer.get());
+    offerAttempts_ = 0;
+    sendOffer();
+}
+
+void Pipeline::sendOffer()
+{
+    utils::ScopedGLibMem offerGChar(gst_sdp_message_as_text(offer_->sdp));
     const auto offerString = std::string(offerGChar.get());
 
-    auto sendOfferReply = whipClient_.sendOffer(offerString);
-    if (sendOfferReply.resource_.empty())
+    ++offerAttempts_;
+    auto sendOfferReply = whipClient_.sendOffer(offerString);
+    if (sendOfferReply.resource_.empty())
+    {
+        Logger::log("Server did not respond with resource");
+        scheduleOfferRetry(sendOfferReply.statusCode_, sendOfferReply.retryAfter_);
+        return;
+    }
+
+    whipResource_ = std::move(sendOfferReply.resource_);
+    etag_ = std::move((sendOfferReply.etag_));
+    Logger::log("Server responded with resource %s, etag %s", whipResource_.c_str(), etag_.c_str());
+
+    if (encodingSuspended_.exchange(false))
+    {
+        Logger::log("Resuming encoding after %u attempts", offerAttempts_);
+        requestKeyframe();
+    }
+
+    // ICE gathering starts with the local description, the servers have to be known by then
+    for (const auto& iceServer : sendOfferReply.iceServers_)
+    {
+        // Credentials stay out of the log
+        const auto credentialsEnd = iceServer.find('@');
+        Logger::log("ICE server from Link header: %s",
+            credentialsEnd == std::string::npos ? iceServer.c_str() : iceServer.c_str() + credentialsEnd + 1);
+        if (g_str_has_prefix(iceServer.c_str(), "stun"))
+        {
+            g_object_set(getElement(ElementLabel::WEBRTC_BIN), "stun-server", iceServer.c_str(), nullptr);
+            continue;
+        }
+        gboolean added = FALSE;
+        g_signal_emit_by_name(getElement(ElementLabel::WEBRTC_BIN), "add-turn-server", iceServer.c_str(), &added);
+    }
+
+    Logger::log("Setting local SDP");
+    g_signal_emit_by_name(getElement(ElementLabel::WEBRTC_BIN), "set-local-description", offer_, nullptr);
+
+    {
+        GstSDPMessage* answerMessage = nullptr;
+
+        // Implicitly deallocated by answer object below
+        if (gst_sdp_message_new_from_text(sendOfferReply.sdpAnswer_.c_str(), &answerMessage) != GST_SDP_OK)
+        {
+            Logger::log("Unable to create SDP object from answer");
+            return;
+        }
+
+        utils::ScopedGstObject answer(gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER, answerMessage));
+        if (!answer.get())
+        {
+            Logger::log("Unable to create SDP object from answer");
+            return;
+        }
+
+        Logger::log("Setting remote SDP");
+        g_signal_emit_by_name(getElement(ElementLabel::WEBRTC_BIN), "set-remote-description", answer.get(), nullptr);
+    }
+}
+
+void Pipeline::scheduleOfferRetry(uint32_t statusCode, std::chrono::seconds retryAfter)
+{
+    // Anything but a server or transport problem will not go away by asking again
+    if (statusCode != 0 && statusCode != 408 && statusCode != 429 && statusCode < 500)
+    {
+        Logger::log("Giving up on WHIP offer, status code %u", statusCode);
+        return;
+    }
+
+    // Nothing is sent until a session exists, demuxed buffers are dropped so the decoders and encoders idle
+    if (!encodingSuspended_.exchange(true))
+    {
+        Logger::log("Suspending encoding until the WHIP session is established");
+    }
+
+    // Half the backoff plus a random share of the other half, so channels failing together do not retry together. A
+    // Retry-After from the server replaces the fixed half, it is a lower bound and only the cap on our own backoff
+    // applies to it.
+    const auto backoffMs = std::min<uint64_t>(
+        static_cast<uint64_t>(offerRetryInitialDelay.count()) << std::min(offerAttempts_ - 1, 16u),
+        offerRetryMaxDelay.count());
+    const auto baseMs = std::max<uint64_t>(backoffMs / 2,
+        static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(retryAfter).count()));
+    const auto delayMs = static_cast<guint>(std::min<uint64_t>(
+        baseMs + g_random_int_range(0, static_cast<gint32>(backoffMs / 2 + 1)),
+        G_MAXUINT));
+
+    Logger::log("Retrying WHIP offer in %u ms (attempt %u)", delayMs, offerAttempts_ + 1);
+    offerRetryId_ = g_timeout_add(delayMs, offerRetryCallback, this);
+}
+
+void Pipeline::onOfferRetry()
+{
+    // The attempt that scheduled this retry has returned by now, at most its thread is still winding down
+    if (offerRetryThread_.joinable())
+    {
+        offerRetryThread_.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(offerMutex_);
+        offerRetryId_ = 0;
+        offerRetryPending_ = true;
+    }
+    offerRetryThread_ = std::thread(&Pipeline::retryOffer, this);
+}
+
+void Pipeline::retryOffer()
+{
+    std::lock_guard<std::mutex> lock(offerMutex_);
+    if (!offerRetryPending_)
+    {
+        // A renegotiated offer was sent in the meantime
+        return;
+    }
+    offerRetryPending_ = false;
+    sendOffer();
+}
+
+void Pipeline::onIceCandidate(guint /*mLineIndex*/, gchar* candidate)
+{
+    if (whipResource_.empty())
+    {
+        Logger::log("Resource string empty");
+        return;
+    }
+
+    std::array<char, 256> candidateString{};
+    snprintf(candidateString.data(), candidateString.size(), "m=audio 9 RTP/AVP 0\r\na=mid:0\r\na=%s\r\n", candidate);
+    whipClient_.updateIce(whipResource_, etag_, candidateString.data());
+}
+
+void Pipeline::onConnectionStateChanged()
+{
+    GstWebRTCPeerConnectionState connectionState;
+    g_object_get(getElement(ElementLabel::WEBRTC_BIN), "connection-state", &connectionState, nullptr);
+    Logger::log("Peer connection state %d", connectionState);
+
+    // The offer may have been sent before the encoder produced its first frame, start the receiver with a key frame
+    if (connectionState == GST_WEBRTC_PEER_CONNECTION_STATE_CONNECTED)
+    {
+        requestKeyframe();
+    }
+}
+
+void Pipeline::makeElement(const ElementLabel elementLabel, const char* element)
+{
+    auto madeElement = makeElement(element);
+    std::lock_guard<std::mutex> lock(elementsMutex_);
+    elements_.emplace(elementLabel, madeElement);
+}
+
+GstElement* Pipeline::getElement(const ElementLabel elementLabel) const
+{
+    std::lock_guard<std::mutex> lock(elementsMutex_);
+    const auto findResult = elements_.find(elementLabel);
+    return findResult != elements_.cend() ? findResult->second : nullptr;
+}
+
+GstElement* Pipeline::makeElement(const char* element)
+{
+    auto result = gst_element_factory_make(element, nullptr);
+    if (!result)
+    {
+        Logger::log("Unable to make gst element %s", element);
+        return nullptr;
+    }
+
+    if (strncmp(element, "queue", 5) == 0)
     {
-        Logger::log("Server did not respond with resource");
+        g_object_set(result, "max-size-buffers", 0, nullptr);
+        g_object_set(result, "max-size-bytes", 0, nullptr);
+        g_object_set(result, "max-size-time", 0, nullptr);
+    }
+
+    // Counted for the control socket snapshot, on the output of the element or the input of sinks
+    utils::ScopedGLibObject srcPad(gst_element_get_static_pad(result, "src"));
+    utils::ScopedGLibObject sinkPad(srcPad.get() ? nullptr : gst_element_get_static_pad(result, "sink"));
+    auto countedPad = srcPad.get() ? srcPad.get() : sinkPad.get();
+    if (countedPad)
+    {
+        auto bufferCount = new std::atomic<uint64_t>(0);
+        g_object_set_qdata_full(G_OBJECT(result), bufferCountQuark(), bufferCount, deleteBufferCount);
+        gst_pad_add_probe(countedPad,
+            static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+            countBuffersProbe,
+            bufferCount,
+            nullptr);
+    }
+
+    if (!gst_bin_add(GST_BIN(pipeline_), result))
+    {
+        Logger::log("Unable to add gst element %s", element);
+        return nullptr;
+    }
+    return result;
+}
+
+void Pipeline::run()
+{
+    if (gst_element_set_state(pipeline_, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    {
+        Logger::log("Unable to set the pipeline to the playing state.");
         return;
     }
+}
 
-    whipResource_ = std::move(sendOfferReply.resource_);
-    etag_ = std::move((sendOfferReply.etag_));
-    Logger::log("Server responded with resource %s, etag %s", whipResource_.c_str(), etag_.c_str());
+bool Pipeline::getSrtStatistics(SrtStatistics& statistics) const
+{
+    auto srtSource = getElement(ElementLabel::SRT_SOURCE);
+    if (!srtSource)
+    {
+        return false;
+    }
 
-    Logger::log("Setting local SDP");
-    g_signal_emit_by_name(elements_[ElementLabel::WEBRTC_BIN], "set-local-description", offer.get(), nullptr);
+    GstStructure* stats = nullptr;
+    g_object_get(srtSource, "stats", &stats, nullptr);
+    if (!stats)
+    {
+        return false;
+    }
+
+    const auto result = SrtStatistics::fromStructure(stats, statistics);
+    gst_structure_free(stats);
+    return result;
+}
 
+std::string Pipeline::getSnapshot()
+{
+    using utils::Json::field;
+    using utils::Json::quote;
+
+    auto webRtcBin = G_OBJECT(getElement(ElementLabel::WEBRTC_BIN));
+    std::string whip = "{";
+    whip.append(field("resource", quote(whipResource_)) + ",");
+    whip.append(field("connectionState", enumNick(webRtcBin, "connection-state")) + ",");
+    whip.append(field("iceConnectionState", enumNick(webRtcBin, "ice-connection-state")) + ",");
+    whip.append(field("signalingState", enumNick(webRtcBin, "signaling-state")) + "}");
+
+    std::string latency = "null";
+    auto latencyQuery = gst_query_new_latency();
+    if (gst_element_query(pipeline_, latencyQuery))
     {
-        GstSDPMessage* answerMessage = nullptr;
+        gboolean live = FALSE;
+        GstClockTime minLatency = 0;
+        GstClockTime maxLatency = 0;
+        gst_query_parse_latency(latencyQuery, &live, &minLatency, &maxLatency);
+        // An unbounded maximum is reported as null
+        latency = "{" + field("live", live == TRUE) + "," +
+            field("minMs", static_cast<double>(minLatency) / GST_MSECOND) + "," +
+            (GST_CLOCK_TIME_IS_VALID(maxLatency) ? field("maxMs", static_cast<double>(maxLatency) / GST_MSECOND)
+                                                 : field("maxMs", std::string("null"))) +
+            "}";
+    }
+    gst_query_unref(latencyQuery);
 
-        // Implicitly deallocated by answer object below
-        if (gst_sdp_message_new_from_text(sendOfferReply.sdpAnswer_.c_str(), &answerMessage) != GST_SDP_OK)
+    std::string elements = "[";
+    auto iterator = gst_bin_iterate_elements(GST_BIN(pipeline_));
+    GValue item = G_VALUE_INIT;
+    auto done = false;
+    while (!done)
+    {
+        switch (gst_iterator_next(iterator, &item))
         {
-            Logger::log("Unable to create SDP object from answer");
-            return;
+        case GST_ITERATOR_OK:
+        {
+            auto element = GST_ELEMENT(g_value_get_object(&item));
+            auto factory = gst_element_get_factory(element);
+            const std::string factoryName = factory ? gst_plugin_feature_get_name(factory) : "";
+
+            std::string entry = "{" + field("name", GST_ELEMENT_NAME(element)) + ",";
+            entry.append(field("factory", quote(factoryName)) + ",");
+            entry.append(field("state", gst_element_state_get_name(GST_STATE(element))));
+            auto bufferCount =
+                reinterpret_cast<std::atomic<uint64_t>*>(g_object_get_qdata(G_OBJECT(element), bufferCountQuark()));
+            if (bufferCount)
+            {
+                entry.append("," + field("buffers", static_cast<uint64_t>(bufferCount->load())));
+            }
+            if (factoryName == "queue")
+            {
+                guint levelBuffers = 0;
+                guint levelBytes = 0;
+                guint64 levelTime = 0;
+                g_object_get(element,
+                    "current-level-buffers",
+                    &levelBuffers,
+                    "current-level-bytes",
+                    &levelBytes,
+                    "current-level-time",
+                    &levelTime,
+                    nullptr);
+                entry.append("," + field("levelBuffers", static_cast<uint64_t>(levelBuffers)));
+                entry.append("," + field("levelBytes", static_cast<uint64_t>(levelBytes)));
+                entry.append("," + field("levelMs", static_cast<double>(levelTime) / GST_MSECOND));
+            }
+            TracerStats::ElementStats tracerStats;
+            if (TracerStats::get() && TracerStats::get()->getElementStats(GST_ELEMENT_NAME(element), tracerStats))
+            {
+                entry.append("," + field("cpuPercent", tracerStats.cpuPercent_));
+                entry.append("," + field("buffersPerSecond", tracerStats.buffersPerSecond_));
+                entry.append("," + field("meanLatencyMs", tracerStats.meanLatencyMs_));
+                entry.append("," + field("maxLatencyMs", tracerStats.maxLatencyMs_));
+            }
+            const auto caps = currentCaps(element);
+            if (!caps.empty())
+            {
+                entry.append("," + field("caps", quote(caps)));
+            }
+            entry.append("}");
+
+            elements.append(elements.size() > 1 ? "," : "");
+            elements.append(entry);
+            g_value_reset(&item);
+            break;
         }
+        case GST_ITERATOR_RESYNC:
+            elements = "[";
+            gst_iterator_resync(iterator);
+            break;
+        default:
+            done = true;
+            break;
+        }
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+    elements.append("]");
 
-        utils::ScopedGstObject answer(gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER, answerMessage));
-        if (!answer.get())
+    std::string encoder = "null";
+    if (getElement(ElementLabel::RTP_VIDEO_ENCODE))
+    {
+        encoder = "{" + field("name", videoEncoder_->name_) + "," +
+            field("bitrateKbps", static_cast<uint64_t>(config_.h264encodeBitrate)) + "," +
+            field("threads", static_cast<uint64_t>(config_.encoderThreads_)) + "}";
+    }
+
+    std::string srt = "null";
+    SrtStatistics srtStatistics;
+    if (getSrtStatistics(srtStatistics))
+    {
+        srt = "{" + field("rttMs", srtStatistics.rttMs_) + "," + field("latencyMs", int64_t{srtStatistics.latencyMs_}) +
+            "," + field("receiveBufferMs", int64_t{srtStatistics.receiveBufferMs_}) + "," +
+            field("packetsReceived", srtStatistics.packetsReceived_) + "," +
+            field("packetsLost", srtStatistics.packetsLost_) + "," +
+            field("packetsRetransmitted", srtStatistics.packetsRetransmitted_) + "," +
+            field("packetsDropped", srtStatistics.packetsDropped_) + "," +
+            field("receiveRateMbps", srtStatistics.receiveRateMbps_) + "}";
+    }
+
+    std::string restream = "[";
+    if (restreamer_)
+    {
+        for (const auto& destination : restreamer_->getStats())
         {
-            Logger::log("Unable to create SDP object from answer");
-            return;
+            restream.append(restream.size() > 1 ? "," : "");
+            restream.append("{" + field("name", quote(destination.name_)) + "," +
+                field("bytesIn", destination.bytesIn_) + "," + field("bytesSent", destination.bytesSent_) + "," +
+                field("buffersDropped", destination.buffersDropped_) + "}");
         }
+    }
+    restream.append("]");
 
-        Logger::log("Setting remote SDP");
-        g_signal_emit_by_name(elements_[ElementLabel::WEBRTC_BIN], "set-remote-description", answer.get(), nullptr);
+    return "{" + field("whip", whip) + "," + field("latency", latency) + "," + field("encoder", encoder) + "," +
+        field("srt", srt) + "," + field("restream", restream) + "," +
+        field("sourceIdle", sourceIdle_.load()) + "," + field("slate", slate_ && slate_->isActive()) + "," +
+        field("memory", memoryAccounting_->toJson()) + "," + field("elements", elements) + "}";
+}
+
+bool Pipeline::setParameter(const std::string& name, const std::string& value)
+{
+    const auto number = std::strtoul(value.c_str(), nullptr, 10);
+
+    if (name == "bitrate")
+    {
+        if (number == 0)
+        {
+            Logger::log("Invalid bitrate %s", value.c_str());
+            return false;
+        }
+        config_.h264encodeBitrate = number;
+
+        // Picked up by the encoder when the first video stream is linked otherwise
+        auto encoder = getElement(ElementLabel::RTP_VIDEO_ENCODE);
+        if (encoder)
+        {
+            videoEncoder_->setBitrate_(encoder, config_.h264encodeBitrate);
+        }
+        Logger::log("Video bitrate set to %u kbps", config_.h264encodeBitrate);
+        return true;
+    }
+
+    if (name == "jitterBufferLatency")
+    {
+        // webrtcbin hands the value on to the jitter buffers of its running rtpbin
+        config_.jitterBufferLatency_ = number;
+        g_object_set(getElement(ElementLabel::WEBRTC_BIN), "latency", config_.jitterBufferLatency_, nullptr);
+        Logger::log("Jitter buffer latency set to %u ms", config_.jitterBufferLatency_);
+        return true;
     }
+
+    if (name == "showTimer")
+    {
+        if (config_.bypass_video_ || !config_.video_)
+        {
+            Logger::log("The timer needs transcoded video");
+            return false;
+        }
+        config_.showTimer_ = number != 0;
+
+        // Once made, the overlay stays in the chain and is only silenced, without a video branch it is made with it
+        auto clockOverlay = getElement(ElementLabel::CLOCK_OVERLAY);
+        if (clockOverlay)
+        {
+            g_object_set(clockOverlay, "silent", !config_.showTimer_, nullptr);
+        }
+        else if (config_.showTimer_ && getElement(ElementLabel::VIDEO_CONVERT) &&
+            !insertClockOverlay())
+        {
+            Logger::log("Unable to insert clock overlay");
+            return false;
+        }
+        Logger::log("Timer %s", config_.showTimer_ ? "shown" : "hidden");
+        return true;
+    }
+
+    Logger::log("Unknown parameter %s", name.c_str());
+    return false;
 }
 
-void Pipeline::onIceCandidate(guint /*mLineIndex*/, gchar* candidate)
+void Pipeline::onIdleTimer()
 {
-    if (whipResource_.empty())
+    const auto lastSourceActivity = lastSourceActivity_.load();
+    const auto idleTime = g_get_monotonic_time() - lastSourceActivity;
+    if (sourceIdle_ || lastSourceActivity == 0 ||
+        idleTime < std::chrono::microseconds(config_.sourceIdleTimeout_).count())
     {
-        Logger::log("Resource string empty");
         return;
     }
 
-    std::array<char, 256> candidateString{};
-    snprintf(candidateString.data(), candidateString.size(), "m=audio 9 RTP/AVP 0\r\na=mid:0\r\na=%s\r\n", candidate);
-    whipClient_.updateIce(whipResource_, etag_, candidateString.data());
+    // Nothing reaches the decoders and encoders from here on, their threads sleep until the source is back. What the
+    // ingest queue still holds below its threshold is dropped when it leaves, not released in a burst on resume.
+    staleSourceBuffers_ = sourceBuffersQueued_.load();
+    dropStaleSourceData_ = true;
+    sourceIdle_ = true;
+    Logger::log("No source data for %lld ms, parking decode and encode branches",
+        static_cast<long long>(idleTime / 1000));
+    if (slate_)
+    {
+        slate_->start();
+    }
 }
 
-void Pipeline::makeElement(const ElementLabel elementLabel, const char* element)
+void Pipeline::onSourceResumed()
 {
-    const auto& result = elements_.emplace(elementLabel, gst_element_factory_make(element, nullptr));
-    if (!result.first->second)
+    if (!sourceIdle_.exchange(false))
     {
-        Logger::log("Unable to make gst element %s", element);
         return;
     }
 
-    if (strncmp(element, "queue", 5) == 0)
+    // Decoding starts over at the next IDR of the source, the encoder starts its output with one too
+    waitingForKeyframe_ = true;
+    Logger::log("Source data resumed, waiting for a key frame");
+    requestKeyframe();
+}
+
+void Pipeline::onSourceKeyframe()
+{
+    Logger::log("Source key frame, video resumed");
+}
+
+void Pipeline::onStatsTimer()
+{
+    threadBudget_->logReport();
+    memoryAccounting_->logReport();
+    logTracerStats();
+
+    SrtStatistics srtStatistics;
+    if (getSrtStatistics(srtStatistics))
     {
-        g_object_set(result.first->second, "max-size-buffers", 0, nullptr);
-        g_object_set(result.first->second, "max-size-bytes", 0, nullptr);
-        g_object_set(result.first->second, "max-size-time", 0, nullptr);
+        Logger::log("SRT source: %s", srtStatistics.toString().c_str());
+        tuneSrtLatency(srtStatistics);
     }
+}
 
-    if (!gst_bin_add(GST_BIN(pipeline_), result.first->second))
+void Pipeline::logTracerStats()
+{
+    auto tracerStats = TracerStats::get();
+    if (!tracerStats)
     {
-        Logger::log("Unable to add gst element %s", element);
         return;
     }
+
+    struct Hotspot
+    {
+        std::string name_;
+        const char* label_;
+        TracerStats::ElementStats stats_;
+    };
+    std::vector<Hotspot> hotspots;
+
+    auto iterator = gst_bin_iterate_elements(GST_BIN(pipeline_));
+    GValue item = G_VALUE_INIT;
+    auto done = false;
+    while (!done)
+    {
+        switch (gst_iterator_next(iterator, &item))
+        {
+        case GST_ITERATOR_OK:
+        {
+            auto element = GST_ELEMENT(g_value_get_object(&item));
+            Hotspot hotspot{GST_ELEMENT_NAME(element), nullptr, {}};
+            if (tracerStats->getElementStats(hotspot.name_, hotspot.stats_))
+            {
+                std::lock_guard<std::mutex> lock(elementsMutex_);
+                const auto labelled = std::find_if(elements_.cbegin(),
+                    elements_.cend(),
+                    [element](const std::pair<const ElementLabel, GstElement*>& entry)
+                    { return entry.second == element; });
+                hotspot.label_ = labelled != elements_.cend() ? elementLabelName(labelled->first) : nullptr;
+                hotspots.push_back(hotspot);
+            }
+            g_value_reset(&item);
+            break;
+        }
+        case GST_ITERATOR_RESYNC:
+            hotspots.clear();
+            gst_iterator_resync(iterator);
+            break;
+        default:
+            done = true;
+            break;
+        }
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+
+    // CPU first, elements without a thread of their own are ranked by the time buffers spend in them
+    std::sort(hotspots.begin(),
+        hotspots.end(),
+        [](const Hotspot& lhs, const Hotspot& rhs)
+        {
+            if (lhs.stats_.cpuPercent_ != rhs.stats_.cpuPercent_)
+            {
+                return lhs.stats_.cpuPercent_ > rhs.stats_.cpuPercent_;
+            }
+            return lhs.stats_.meanLatencyMs_ * lhs.stats_.buffersPerSecond_ >
+                rhs.stats_.meanLatencyMs_ * rhs.stats_.buffersPerSecond_;
+        });
+
+    Logger::log("Tracers: process %.1f%% cpu, hotspots:", tracerStats->getProcessCpuPercent());
+    for (size_t i = 0; i < std::min(hotspots.size(), maxLoggedHotspots); ++i)
+    {
+        const auto& hotspot = hotspots[i];
+        Logger::log("  %s%s%s%s: %.1f%% cpu, %.0f buffers/s, %.2f ms mean, %.2f ms max latency",
+            hotspot.name_.c_str(),
+            hotspot.label_ ? " (" : "",
+            hotspot.label_ ? hotspot.label_ : "",
+            hotspot.label_ ? ")" : "",
+            hotspot.stats_.cpuPercent_,
+            hotspot.stats_.buffersPerSecond_,
+            hotspot.stats_.meanLatencyMs_,
+            hotspot.stats_.maxLatencyMs_);
+    }
 }
 
-void Pipeline::run()
+const char* Pipeline::elementLabelName(ElementLabel label)
 {
-    if (gst_element_set_state(pipeline_, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    switch (label)
+    {
+    case ElementLabel::UDP_SOURCE:
+        return "UDP_SOURCE";
+    case ElementLabel::UDP_QUEUE:
+        return "UDP_QUEUE";
+    case ElementLabel::TS_DEMUX:
+        return "TS_DEMUX";
+    case ElementLabel::SRT_SOURCE:
+        return "SRT_SOURCE";
+    case ElementLabel::APP_SOURCE:
+        return "APP_SOURCE";
+    case ElementLabel::TEE:
+        return "TEE";
+    case ElementLabel::CLOCK_OVERLAY:
+        return "CLOCK_OVERLAY";
+    case ElementLabel::VIDEO_CONVERT:
+        return "VIDEO_CONVERT";
+    case ElementLabel::VIDEO_TEE:
+        return "VIDEO_TEE";
+    case ElementLabel::RTP_VIDEO_ENCODE:
+        return "RTP_VIDEO_ENCODE";
+    case ElementLabel::RTP_VIDEO_PAYLOAD:
+        return "RTP_VIDEO_PAYLOAD";
+    case ElementLabel::RTP_VIDEO_PAYLOAD_QUEUE:
+        return "RTP_VIDEO_PAYLOAD_QUEUE";
+    case ElementLabel::WEBRTC_BIN:
+        return "WEBRTC_BIN";
+    }
+    return "";
+}
+
+void Pipeline::tuneSrtLatency(const SrtStatistics& statistics)
+{
+    // Counters restart with every new connection
+    if (statistics.packetsReceived_ < srtPacketsReceived_)
+    {
+        srtLatencyTuned_ = false;
+    }
+    srtPacketsReceived_ = statistics.packetsReceived_;
+
+    if (!config_.srtLatencyAutoTune_ || srtLatencyTuned_ || statistics.rttMs_ <= 0)
+    {
+        return;
+    }
+    srtLatencyTuned_ = true;
+
+    const auto latency = srtLatencyFromRtt(statistics.rttMs_, config_);
+    if (latency == srtLatency_)
     {
-        Logger::log("Unable to set the pipeline to the playing state.");
         return;
     }
+
+    // SRT negotiates latency in the handshake, the new value takes effect from the next connection
+    Logger::log("SRT latency %u ms -> %u ms from measured rtt %.1f ms", srtLatency_, latency, statistics.rttMs_);
+    srtLatency_ = latency;
+    g_object_set(getElement(ElementLabel::SRT_SOURCE), "latency", srtLatency_, nullptr);
+}
+
+bool Pipeline::pushSourceData(const uint8_t* data, size_t size)
+{
+    auto buffer = gst_buffer_new_allocate(nullptr, size, nullptr);
+    gst_buffer_fill(buffer, 0, data, size);
+    return gst_app_src_push_buffer(GST_APP_SRC(getElement(ElementLabel::APP_SOURCE)), buffer) == GST_FLOW_OK;
+}
+
+void Pipeline::endOfSource()
+{
+    gst_app_src_end_of_stream(GST_APP_SRC(getElement(ElementLabel::APP_SOURCE)));
 }
 
 void Pipeline::stop()
@@ -797,12 +2169,117 @@ gboolean Pipeline::pipelineBusWatch(GstBus* /*bus*/, GstMessage* message, gpoint
     return TRUE;
 }
 
+GstBusSyncReply Pipeline::busSyncHandler(GstBus* /*bus*/, GstMessage* message, gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_STREAM_STATUS)
+    {
+        pipelineImpl->onStreamStatus(message);
+        return GST_BUS_PASS;
+    }
+
+    // Runs in the demuxer's streaming thread, so the PMT is known before its pads are added
+    auto section = gst_message_parse_mpegts_section(message);
+    if (section)
+    {
+        if (GST_MPEGTS_SECTION_TYPE(section) == GST_MPEGTS_SECTION_PMT)
+        {
+            pipelineImpl->onPmt(section);
+        }
+        gst_mpegts_section_unref(section);
+    }
+    return GST_BUS_PASS;
+}
+
+GstPadProbeReturn Pipeline::demuxEosProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_EOS && !pipelineImpl->sourceEnded_)
+    {
+        return GST_PAD_PROBE_DROP;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn Pipeline::sourceEosProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_EOS)
+    {
+        pipelineImpl->sourceEnded_ = true;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn Pipeline::insertClockOverlayProbe(GstPad* pad, GstPadProbeInfo* /*info*/, gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    auto clockOverlay = pipelineImpl->getElement(ElementLabel::CLOCK_OVERLAY);
+    auto videoConvert = pipelineImpl->getElement(ElementLabel::VIDEO_CONVERT);
+
+    utils::ScopedGLibObject convertSinkPad(gst_element_get_static_pad(videoConvert, "sink"));
+    utils::ScopedGLibObject overlaySinkPad(gst_element_get_static_pad(clockOverlay, "sink"));
+    gst_pad_unlink(pad, convertSinkPad.get());
+    if (!gst_element_link(clockOverlay, videoConvert) || gst_pad_link(pad, overlaySinkPad.get()) != GST_PAD_LINK_OK)
+    {
+        Logger::log("Unable to insert clock overlay");
+        gst_pad_link(pad, convertSinkPad.get());
+        return GST_PAD_PROBE_REMOVE;
+    }
+    gst_element_sync_state_with_parent(clockOverlay);
+    Logger::log("Clock overlay inserted");
+    return GST_PAD_PROBE_REMOVE;
+}
+
+GstPadProbeReturn Pipeline::unlinkBranchProbe(GstPad* pad, GstPadProbeInfo* /*info*/, gpointer userData)
+{
+    auto branchRemoval = reinterpret_cast<BranchRemoval*>(userData);
+
+    utils::ScopedGLibObject peerPad(gst_pad_get_peer(pad));
+    if (peerPad.get())
+    {
+        gst_pad_unlink(pad, peerPad.get());
+    }
+
+    // Nothing passes the branch anymore, its probes go before the next branch feeds the shared encoder
+    branchRemoval->pipeline_->releaseBranchProbes(branchRemoval->branch_);
+
+    // The shared tail is free now, a stream held back until now can take it
+    branchRemoval->pipeline_->linkPendingPads();
+
+    g_idle_add(removeBranchCallback, branchRemoval);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+gboolean Pipeline::removeBranchCallback(gpointer userData)
+{
+    std::unique_ptr<BranchRemoval> branchRemoval(reinterpret_cast<BranchRemoval*>(userData));
+    for (auto element : branchRemoval->branch_.elements_)
+    {
+        gst_element_set_state(element, GST_STATE_NULL);
+        gst_bin_remove(branchRemoval->bin_, element);
+    }
+    gst_object_unref(branchRemoval->bin_);
+    return G_SOURCE_REMOVE;
+}
+
+GstPadProbeReturn Pipeline::dropProbe(GstPad* /*pad*/, GstPadProbeInfo* /*info*/, gpointer /*userData*/)
+{
+    return GST_PAD_PROBE_DROP;
+}
+
 void Pipeline::demuxPadAddedCallback(GstElement* /*src*/, GstPad* newPad, gpointer userData)
 {
     auto impl = reinterpret_cast<Pipeline*>(userData);
     impl->onDemuxPadAdded(newPad);
 }
 
+void Pipeline::demuxPadRemovedCallback(GstElement* /*src*/, GstPad* pad, gpointer userData)
+{
+    auto impl = reinterpret_cast<Pipeline*>(userData);
+    impl->onDemuxPadRemoved(pad);
+}
+
 void Pipeline::demuxNoMorePadsCallback(GstElement* /*src*/, gpointer userData)
 {
     auto impl = reinterpret_cast<Pipeline*>(userData);
@@ -827,6 +2304,106 @@ void Pipeline::onIceCandidateCallback(GstElement* /*webrtc*/, guint mLineIndex,
     pipelineImpl->onIceCandidate(mLineIndex, candidate);
 }
 
+void Pipeline::onConnectionStateChangedCallback(GstElement* /*webrtc*/, GParamSpec* /*pspec*/, gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    pipelineImpl->onConnectionStateChanged();
+}
+
+GstPadProbeReturn Pipeline::videoUpstreamEventProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    return pipelineImpl->onVideoUpstreamEvent(GST_PAD_PROBE_INFO_EVENT(info));
+}
+
+gboolean Pipeline::statsTimerCallback(gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    pipelineImpl->onStatsTimer();
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean Pipeline::offerRetryCallback(gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    pipelineImpl->onOfferRetry();
+    return G_SOURCE_REMOVE;
+}
+
+GstPadProbeReturn Pipeline::videoGateProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    if (pipelineImpl->encodingSuspended_ || pipelineImpl->sourceIdle_)
+    {
+        return GST_PAD_PROBE_DROP;
+    }
+
+    if (pipelineImpl->waitingForKeyframe_)
+    {
+        if (GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_DELTA_UNIT))
+        {
+            return GST_PAD_PROBE_DROP;
+        }
+        pipelineImpl->waitingForKeyframe_ = false;
+        pipelineImpl->onSourceKeyframe();
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn Pipeline::audioGateProbe(GstPad* /*pad*/, GstPadProbeInfo* /*info*/, gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    return pipelineImpl->encodingSuspended_ || pipelineImpl->sourceIdle_ ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn Pipeline::sourceActivityProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    pipelineImpl->lastSourceActivity_ = g_get_monotonic_time();
+    pipelineImpl->sourceBuffersQueued_ += probeBufferCount(info);
+    if (pipelineImpl->sourceIdle_)
+    {
+        pipelineImpl->onSourceResumed();
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn Pipeline::staleSourceDataProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    if (!pipelineImpl->dropStaleSourceData_)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // The queue is first in first out, also when it leaks the oldest data over the memory budget. Everything that came
+    // in and is not in the queue anymore, dequeued or leaked, came before this data. The level is read first, a buffer
+    // queued in between makes this one look newer, not older.
+    guint queuedBuffers = 0;
+    g_object_get(GST_PAD_PARENT(pad), "current-level-buffers", &queuedBuffers, nullptr);
+    const auto index = pipelineImpl->sourceBuffersQueued_ - queuedBuffers - probeBufferCount(info);
+    if (index < pipelineImpl->staleSourceBuffers_)
+    {
+        return GST_PAD_PROBE_DROP;
+    }
+    pipelineImpl->dropStaleSourceData_ = false;
+    return GST_PAD_PROBE_OK;
+}
+
+gboolean Pipeline::idleTimerCallback(gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    pipelineImpl->onIdleTimer();
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean Pipeline::snapshotSignalCallback(gpointer userData)
+{
+    auto pipelineImpl = reinterpret_cast<Pipeline*>(userData);
+    Logger::log("SIGUSR1 received, snapshot: %s", pipelineImpl->getSnapshot().c_str());
+    return G_SOURCE_CONTINUE;
+}
+
 gboolean Pipeline::signalHandlerCallback(gpointer userData)
 {
     auto pipeline = reinterpret_cast<GstElement*>(userData);
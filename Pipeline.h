@@ -1,14 +1,36 @@
 #pragma once
 #define GST_USE_UNSTABLE_API 1
 
+#include "Config.h"
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <functional>
 #include <gst/gst.h>
+#include <gst/mpegts/mpegts.h>
+#include <gst/webrtc/webrtc.h>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
-struct Config;
+class CaptionRelay;
+class EncoderBenchmark;
+class FileSource;
+struct SrtStatistics;
+struct VideoEncoder;
+class KeyframeCache;
+class MemoryAccounting;
+class PcrClock;
+class Recorder;
+class Restreamer;
+class RtpPacer;
+class Scte35Cues;
+class Slate;
+class ThreadBudget;
+class TimedMetadata;
 
 namespace http
 {
@@ -25,19 +47,47 @@ public:
     void stop();
     const std::string& getWhipResource() const { return whipResource_; }
 
+    bool getSrtStatistics(SrtStatistics& statistics) const;
+    std::string getSnapshot();
+    bool setParameter(const std::string& name, const std::string& value);
+
+    bool pushSourceData(const uint8_t* data, size_t size);
+    void endOfSource();
+    void setEndOfInputHandler(std::function<void()> handler) { endOfInputHandler_ = std::move(handler); }
+
     void onDemuxPadAdded(GstPad* newPad);
+    void onDemuxPadRemoved(GstPad* pad);
     void onDemuxNoMorePads();
     void onOfferCreated(GstPromise* promise);
     void onNegotiationNeeded();
     void onIceCandidate(guint mLineIndex, gchar* candidate);
+    void onConnectionStateChanged();
 
     static gboolean pipelineBusWatch(GstBus* /*bus*/, GstMessage* message, gpointer userData);
+    static GstBusSyncReply busSyncHandler(GstBus* /*bus*/, GstMessage* message, gpointer userData);
+    static GstPadProbeReturn dropProbe(GstPad* /*pad*/, GstPadProbeInfo* /*info*/, gpointer /*userData*/);
+    static GstPadProbeReturn demuxEosProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn sourceEosProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn insertClockOverlayProbe(GstPad* pad, GstPadProbeInfo* /*info*/, gpointer userData);
+    static GstPadProbeReturn unlinkBranchProbe(GstPad* pad, GstPadProbeInfo* /*info*/, gpointer userData);
+    static gboolean removeBranchCallback(gpointer userData);
     static void demuxPadAddedCallback(GstElement* /*src*/, GstPad* newPad, gpointer userData);
+    static void demuxPadRemovedCallback(GstElement* /*src*/, GstPad* pad, gpointer userData);
     static void demuxNoMorePadsCallback(GstElement* /*src*/, gpointer userData);
     static void onOfferCreatedCallback(GstPromise* promise, gpointer userData);
     static void onNegotiationNeededCallback(GstElement* /*webRtcBin*/, gpointer userData);
     static void onIceCandidateCallback(GstElement* /*webrtc*/, guint mLineIndex, gchar* candidate, gpointer userData);
+    static void onConnectionStateChangedCallback(GstElement* /*webrtc*/, GParamSpec* /*pspec*/, gpointer userData);
+    static GstPadProbeReturn videoUpstreamEventProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+    static gboolean statsTimerCallback(gpointer userData);
     static gboolean signalHandlerCallback(gpointer userData);
+    static gboolean snapshotSignalCallback(gpointer userData);
+    static gboolean offerRetryCallback(gpointer userData);
+    static GstPadProbeReturn videoGateProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn audioGateProbe(GstPad* /*pad*/, GstPadProbeInfo* /*info*/, gpointer userData);
+    static GstPadProbeReturn sourceActivityProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn staleSourceDataProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData);
+    static gboolean idleTimerCallback(gpointer userData);
 
 private:
 private:
@@ -49,65 +99,169 @@ private:
 
         SRT_SOURCE,
 
-        TEE,
-        RESTREAM_QUEUE,
-        UDP_DEST,
-        SRT_DEST,
-
-        H264_PARSE,
-        H264_DECODE,
+        APP_SOURCE,
 
-        H265_PARSE,
-        H265_DECODE,
-
-        VIDEO_CONVERT,
+        TEE,
 
         CLOCK_OVERLAY,
-
-        MPEG2_PARSE,
-        MPEG2_DECODE,
-
+        VIDEO_CONVERT,
+        VIDEO_TEE,
         RTP_VIDEO_ENCODE,
         RTP_VIDEO_PAYLOAD,
         RTP_VIDEO_PAYLOAD_QUEUE,
-        RTP_VIDEO_FILTER,
 
-        AAC_PARSE,
-        AAC_DECODE,
+        WEBRTC_BIN
+    };
+
+    struct StreamType
+    {
+        const char* capsPrefix_;
+        bool video_;
+        bool passthroughAllowed_;
+        std::vector<const char*> elements_;
+    };
 
-        PCM_PARSE,
+    // Elements made for one demuxed stream, from its parser up to the shared encoder or payloader
+    struct StreamBranch
+    {
+        std::string padName_;
+        bool video_;
+        std::vector<GstElement*> elements_;
+        // Probe the branch's parser, released once the branch is unlinked
+        std::shared_ptr<KeyframeCache> keyframeCache_;
+        std::unique_ptr<Scte35Cues> scte35Cues_;
+        std::unique_ptr<CaptionRelay> captionRelay_;
+    };
 
-        OPUS_PARSE,
-        OPUS_DECODE,
+    // Stream branch being torn down, handed from the streaming thread to the main loop
+    struct BranchRemoval
+    {
+        Pipeline* pipeline_;
+        GstBin* bin_;
+        StreamBranch branch_;
+    };
 
-        AUDIO_CONVERT,
-        AUDIO_RESAMPLE,
+    // Demux pad that could not be linked yet, its buffers are dropped until a branch for it can be built
+    struct PendingPad
+    {
+        GstPad* pad_;
+        gulong probeId_;
+    };
 
-        RTP_AUDIO_ENCODE,
-        RTP_AUDIO_PAYLOAD,
-        RTP_AUDIO_PAYLOAD_QUEUE,
-        RTP_AUDIO_FILTER,
+    // Opus payloader and queue feeding one audio transceiver
+    struct AudioOutput
+    {
+        AudioOutput() : payloader_(nullptr), queue_(nullptr), encodeTail_(nullptr), encoder_(nullptr) {}
 
-        WEBRTC_BIN
+        GstElement* payloader_;
+        GstElement* queue_;
+        GstElement* encodeTail_;
+        GstElement* encoder_;
+        std::string padName_;
     };
 
+    static const std::vector<StreamType> streamTypes_;
+
     http::WhipClient& whipClient_;
-    const Config& config_;
+    // Own copy, setParameter changes it while running
+    Config config_;
 
     GstBus* pipelineMessageBus_;
     GstElement* pipeline_;
+    // Written by the demuxer's streaming thread when the first video stream is linked, read from any thread
+    mutable std::mutex elementsMutex_;
     std::map<ElementLabel, GstElement*> elements_;
+    std::vector<StreamBranch> streamBranches_;
+    std::vector<PendingPad> pendingPads_;
+    std::vector<GstElement*> ingestElements_;
+    std::vector<AudioOutput> audioOutputs_;
+    std::mutex audioSelectionMutex_;
+    std::vector<int32_t> selectedAudioPids_;
+    std::unique_ptr<Restreamer> restreamer_;
+    std::unique_ptr<Recorder> recorder_;
+    std::unique_ptr<PcrClock> pcrClock_;
+    std::unique_ptr<RtpPacer> rtpPacer_;
+    // Cache of the linked video branch, asked for replays on webrtcbin's RTCP thread
+    std::mutex keyframeCacheMutex_;
+    std::shared_ptr<KeyframeCache> keyframeCache_;
+    std::unique_ptr<EncoderBenchmark> encoderBenchmark_;
+    std::unique_ptr<ThreadBudget> threadBudget_;
+    std::unique_ptr<MemoryAccounting> memoryAccounting_;
+    std::unique_ptr<Slate> slate_;
+    std::unique_ptr<TimedMetadata> timedMetadata_;
+    std::unique_ptr<FileSource> fileSource_;
+    std::function<void()> endOfInputHandler_;
+    std::map<std::string, GstWebRTCDataChannel*> dataChannels_;
 
     std::string whipResource_;
     std::string etag_;
 
+    guint statsTimerId_;
+    guint snapshotSignalId_;
+    uint32_t srtLatency_;
+    bool srtLatencyTuned_;
+    int64_t srtPacketsReceived_;
+    std::atomic<gint64> lastKeyframeRequestTime_;
+    const VideoEncoder* videoEncoder_;
+    std::atomic<bool> sourceEnded_;
+
+    // Last offer, kept until the WHIP server accepts it
+    std::mutex offerMutex_;
+    GstWebRTCSessionDescription* offer_;
+    guint offerRetryId_;
+    uint32_t offerAttempts_;
+    // Retries are posted from here, the main loop does not wait for the WHIP server
+    std::thread offerRetryThread_;
+    bool offerRetryPending_;
+    std::atomic<bool> encodingSuspended_;
+
+    // Source activity, see Config::sourceIdleTimeout_
+    guint idleTimerId_;
+    std::atomic<gint64> lastSourceActivity_;
+    std::atomic<bool> sourceIdle_;
+    std::atomic<bool> waitingForKeyframe_;
+    // Buffers that entered the ingest queue, those queued before going idle are stale until the first newer one leaves
+    std::atomic<uint64_t> sourceBuffersQueued_;
+    std::atomic<uint64_t> staleSourceBuffers_;
+    std::atomic<bool> dropStaleSourceData_;
+
     void makeElement(const ElementLabel elementLabel, const char* element);
-    void onH264SinkPadAdded(GstPad* newPad);
-    void onH265SinkPadAdded(GstPad* newPad);
-    void onMpeg2SinkPadAdded(GstPad* newPad);
-    void onAacSinkPadAdded(GstPad* newPad);
-    void onPcmSinkPadAdded(GstPad* newPad);
-    void onOpusSinkPadAdded(GstPad* newPad);
-
-    GstElement* addClockOverlay(GstElement* lastElement);
+    GstElement* makeElement(const char* element);
+    GstElement* getElement(const ElementLabel elementLabel) const;
+
+    void onPmt(GstMpegtsSection* section);
+    void onStreamStatus(GstMessage* message);
+    AudioOutput* selectAudioOutput(const std::string& padName);
+    bool linkDemuxPad(GstPad* newPad, bool replacing);
+    void linkPendingPads();
+    bool linkStreamBranch(GstPad* newPad, const StreamType& streamType, bool passthrough, AudioOutput* audioOutput);
+    GstElement* makeVideoEncodeTail();
+    bool insertClockOverlay();
+    GstElement* makeAudioEncodeTail(AudioOutput& audioOutput);
+    void discardStreamBranch(StreamBranch& branch, bool passthrough, AudioOutput* audioOutput);
+    void releaseBranchProbes(StreamBranch& branch);
+    void unlinkSinkPad(GstElement* element);
+    bool relinkToPayloader(GstElement* encoder, GstElement* payloader);
+    GstElement* linkEncodeTail(const std::vector<GstElement*>& tail, GstElement* payloader);
+    void sendOffer();
+    void onOfferRetry();
+    void retryOffer();
+    void scheduleOfferRetry(uint32_t statusCode, std::chrono::seconds retryAfter);
+    void setCodecPreferences(GstCaps* rtpCaps);
+    void requestKeyframe();
+    bool forceKeyframeAt(GstClockTime runningTime);
+    bool linkOutput(GstElement* queue, GstCaps* rtpCaps);
+    void makeDataChannel(const char* label);
+    bool sendDataChannelMessage(const std::string& label, const std::string& message);
+    GstPadProbeReturn onVideoUpstreamEvent(GstEvent* event);
+
+    void makeSlate();
+    void onIdleTimer();
+    void onSourceResumed();
+    void onSourceKeyframe();
+
+    void onStatsTimer();
+    void logTracerStats();
+    static const char* elementLabelName(ElementLabel label);
+    void tuneSrtLatency(const SrtStatistics& statistics);
 };
@@ -0,0 +1,347 @@
+#include "Recorder.h"
+#include "Config.h"
+#include "Logger.h"
+#include "utils/TsPacket.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <gst/app/gstappsink.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+// Every write is a whole number of TS packets and of 4 KiB disk blocks
+const size_t blockSize = 4096;
+const size_t stagingSize = utils::TsPacket::size * blockSize;
+
+// The tail of a segment is padded with null packets up to a size that is a multiple of both
+const size_t paddingUnit = utils::TsPacket::size * (blockSize / 4);
+
+// Buffers the writer has not taken yet, beyond that appsink drops the oldest
+const guint maxPendingBuffers = 2000;
+
+// A source without random access indicators still gets its segments rotated
+const uint32_t maxSegmentDurationFactor = 2;
+
+void makeNullPacket(uint8_t* packet)
+{
+    memset(packet, 0xFF, utils::TsPacket::size);
+    packet[0] = utils::TsPacket::syncByte;
+    packet[1] = utils::TsPacket::nullPid >> 8;
+    packet[2] = utils::TsPacket::nullPid & 0xFF;
+    packet[3] = 0x10;
+}
+
+} // namespace
+
+Recorder::Recorder(GstBin* bin, const Config& config)
+    : bin_(bin),
+      config_(config),
+      queue_(nullptr),
+      sink_(nullptr),
+      stopping_(false),
+      failed_(false),
+      staging_(nullptr),
+      staged_(0),
+      nextSegment_(0),
+      unalignedBuffers_(0)
+{
+}
+
+Recorder::~Recorder()
+{
+    stopping_ = true;
+    if (writer_.joinable())
+    {
+        writer_.join();
+    }
+    free(staging_);
+}
+
+bool Recorder::link(GstElement* tee)
+{
+    void* staging = nullptr;
+    if (posix_memalign(&staging, blockSize, stagingSize) != 0)
+    {
+        Logger::log("Unable to allocate recorder buffer");
+        return false;
+    }
+    staging_ = reinterpret_cast<uint8_t*>(staging);
+
+    if (g_mkdir_with_parents(config_.recordDirectory_.c_str(), 0755) != 0)
+    {
+        Logger::log("Unable to create recording directory %s: %s", config_.recordDirectory_.c_str(), strerror(errno));
+        return false;
+    }
+    nextSegment_ = findNextSegment();
+
+    queue_ = gst_element_factory_make("queue", nullptr);
+    sink_ = gst_element_factory_make("appsink", nullptr);
+    if (!queue_ || !sink_)
+    {
+        Logger::log("Unable to make recorder elements");
+        return false;
+    }
+
+    // Like the restream branches, a recorder that cannot keep up loses data instead of blocking the tee
+    g_object_set(queue_,
+        "max-size-buffers",
+        0,
+        "max-size-bytes",
+        0,
+        "max-size-time",
+        GST_SECOND,
+        "leaky",
+        2, // downstream
+        nullptr);
+    g_object_set(sink_,
+        "sync",
+        FALSE,
+        "async",
+        FALSE,
+        "max-buffers",
+        maxPendingBuffers,
+        "drop",
+        TRUE,
+        nullptr);
+
+    gst_bin_add_many(bin_, queue_, sink_, nullptr);
+    g_object_set(tee, "allow-not-linked", TRUE, nullptr);
+    if (!gst_element_link_many(tee, queue_, sink_, nullptr))
+    {
+        Logger::log("Recorder could not be linked.");
+        return false;
+    }
+
+    Logger::log("Recording to %s, %u segments of %llu s, starting at segment %u",
+        config_.recordDirectory_.c_str(),
+        config_.recordSegments_,
+        static_cast<unsigned long long>(config_.recordSegmentDuration_.count()),
+        nextSegment_);
+    writer_ = std::thread(&Recorder::writeLoop, this);
+    return true;
+}
+
+void Recorder::writeLoop()
+{
+    while (!stopping_)
+    {
+        auto sample = gst_app_sink_try_pull_sample(GST_APP_SINK(sink_), 100 * GST_MSECOND);
+        if (!sample)
+        {
+            continue;
+        }
+
+        auto buffer = gst_sample_get_buffer(sample);
+        GstMapInfo mapInfo;
+        if (!failed_ && buffer && gst_buffer_map(buffer, &mapInfo, GST_MAP_READ))
+        {
+            onData(mapInfo.data, mapInfo.size);
+            gst_buffer_unmap(buffer, &mapInfo);
+        }
+        gst_sample_unref(sample);
+    }
+    closeSegment();
+}
+
+void Recorder::onData(const uint8_t* data, size_t size)
+{
+    // Sources deliver whole packets, the aligned writes and the index depend on that
+    if (size % utils::TsPacket::size != 0 || data[0] != utils::TsPacket::syncByte)
+    {
+        if (unalignedBuffers_++ == 0)
+        {
+            Logger::log("Recorder dropping buffers that are not whole TS packets");
+        }
+        return;
+    }
+
+    const auto maxSegmentSize = config_.recordSegmentSize_ * 1024ULL * 1024ULL;
+    auto elapsed = std::chrono::steady_clock::now() - segment_.start_;
+    for (size_t position = 0; position < size; position += utils::TsPacket::size)
+    {
+        const auto packet = data + position;
+        if (segment_.fd_ < 0 || rotationDue(packet, elapsed) ||
+            segment_.written_ + staged_ + utils::TsPacket::size + paddingUnit > maxSegmentSize)
+        {
+            closeSegment();
+            if (!openSegment())
+            {
+                failed_ = true;
+                return;
+            }
+            elapsed = std::chrono::steady_clock::duration::zero();
+        }
+
+        indexPacket(packet, segment_.written_ + staged_);
+        memcpy(staging_ + staged_, packet, utils::TsPacket::size);
+        staged_ += utils::TsPacket::size;
+        if (staged_ == stagingSize && !flushStaging(false))
+        {
+            failed_ = true;
+            return;
+        }
+    }
+}
+
+bool Recorder::rotationDue(const uint8_t* packet, std::chrono::steady_clock::duration elapsed) const
+{
+    if (elapsed >= config_.recordSegmentDuration_ * maxSegmentDurationFactor)
+    {
+        return true;
+    }
+    return elapsed >= config_.recordSegmentDuration_ && utils::TsPacket::randomAccess(packet);
+}
+
+uint32_t Recorder::findNextSegment() const
+{
+    // A restart continues the ring after the newest segment, the oldest one is overwritten first
+    uint32_t newest = config_.recordSegments_ - 1;
+    int64_t newestTime = -1;
+    for (uint32_t number = 0; number < config_.recordSegments_; ++number)
+    {
+        struct stat status = {};
+        if (stat(segmentPath(number, "ts").c_str(), &status) != 0)
+        {
+            continue;
+        }
+        const auto modified = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+        if (modified > newestTime)
+        {
+            newest = number;
+            newestTime = modified;
+        }
+    }
+    return (newest + 1) % config_.recordSegments_;
+}
+
+std::string Recorder::segmentPath(uint32_t number, const char* extension) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/segment-%03u.%s", number, extension);
+    return config_.recordDirectory_ + name;
+}
+
+bool Recorder::openSegment()
+{
+    segment_.number_ = nextSegment_;
+    nextSegment_ = (nextSegment_ + 1) % config_.recordSegments_;
+
+    const auto path = segmentPath(segment_.number_, "ts");
+    segment_.fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (segment_.fd_ < 0 && errno == EINVAL)
+    {
+        // Some file systems, e.g. tmpfs, have no direct I/O, the aligned writes still keep the overhead low
+        segment_.fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (segment_.fd_ < 0)
+    {
+        Logger::log("Unable to open recording segment %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // One allocation up front instead of one per write, and the segment's blocks stay contiguous
+    const auto result = posix_fallocate(segment_.fd_, 0, config_.recordSegmentSize_ * 1024LL * 1024LL);
+    if (result != 0)
+    {
+        Logger::log("Unable to preallocate recording segment %s: %s", path.c_str(), strerror(result));
+    }
+
+    const auto indexPath = segmentPath(segment_.number_, "idx");
+    segment_.index_ = fopen(indexPath.c_str(), "w");
+    if (!segment_.index_)
+    {
+        Logger::log("Unable to open recording index %s: %s", indexPath.c_str(), strerror(errno));
+    }
+    else
+    {
+        const auto now = std::chrono::system_clock::now().time_since_epoch();
+        fprintf(segment_.index_,
+            "start %lld\n",
+            static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count()));
+    }
+
+    segment_.written_ = 0;
+    segment_.start_ = std::chrono::steady_clock::now();
+    return true;
+}
+
+void Recorder::closeSegment()
+{
+    if (segment_.fd_ < 0)
+    {
+        return;
+    }
+
+    // The preallocated space beyond the data is given back, readers see a file of whole packets
+    flushStaging(true);
+    if (ftruncate(segment_.fd_, segment_.written_) != 0)
+    {
+        Logger::log("Unable to truncate recording segment %u: %s", segment_.number_, strerror(errno));
+    }
+    close(segment_.fd_);
+    segment_.fd_ = -1;
+
+    if (segment_.index_)
+    {
+        fprintf(segment_.index_, "end %llu\n", static_cast<unsigned long long>(segment_.written_));
+        fclose(segment_.index_);
+        segment_.index_ = nullptr;
+    }
+}
+
+bool Recorder::flushStaging(bool padToBlock)
+{
+    if (padToBlock && staged_ % paddingUnit != 0)
+    {
+        const auto paddedSize = (staged_ / paddingUnit + 1) * paddingUnit;
+        for (; staged_ < paddedSize; staged_ += utils::TsPacket::size)
+        {
+            makeNullPacket(staging_ + staged_);
+        }
+    }
+    if (staged_ == 0)
+    {
+        return true;
+    }
+
+    const auto written = pwrite(segment_.fd_, staging_, staged_, segment_.written_);
+    if (written != static_cast<ssize_t>(staged_))
+    {
+        Logger::log("Recording segment %u write failed, recording stopped: %s",
+            segment_.number_,
+            written < 0 ? strerror(errno) : "short write");
+        staged_ = 0;
+        return false;
+    }
+    segment_.written_ += staged_;
+    staged_ = 0;
+    return true;
+}
+
+void Recorder::indexPacket(const uint8_t* packet, uint64_t offset)
+{
+    if (!segment_.index_)
+    {
+        return;
+    }
+
+    uint64_t pcr = 0;
+    if (utils::TsPacket::pcr(packet, pcr))
+    {
+        fprintf(segment_.index_,
+            "pcr %llu %llu\n",
+            static_cast<unsigned long long>(offset),
+            static_cast<unsigned long long>(pcr));
+    }
+    if (utils::TsPacket::randomAccess(packet))
+    {
+        fprintf(segment_.index_,
+            "rai %llu %u\n",
+            static_cast<unsigned long long>(offset),
+            static_cast<unsigned>(utils::TsPacket::pid(packet)));
+    }
+}
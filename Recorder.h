@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <gst/gst.h>
+#include <string>
+#include <thread>
+
+struct Config;
+
+/**
+ * Records the incoming MPEG-TS into a ring of segment files, so the last minutes of a source can be pulled after an
+ * incident. The recorder hangs off the source tee behind its own leaky queue and an appsink that drops when full, and
+ * all disk I/O happens on a writer thread, so a slow disk loses recorded data but never delays the live path.
+ *
+ * Each segment file is preallocated when it is opened and written with O_DIRECT in large chunks aligned to both the
+ * TS packet and the disk block size, bypassing the page cache. Segments rotate at the first random access packet
+ * after the segment duration, so every segment starts decodable. Next to every segment, a text index lists the byte
+ * offsets of PCRs and random access packets.
+ */
+class Recorder
+{
+public:
+    Recorder(GstBin* bin, const Config& config);
+    ~Recorder();
+
+    bool link(GstElement* tee);
+
+private:
+    struct Segment
+    {
+        Segment() : fd_(-1), index_(nullptr), number_(0), written_(0) {}
+
+        int fd_;
+        FILE* index_;
+        uint32_t number_;
+        uint64_t written_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    GstBin* bin_;
+    const Config& config_;
+    GstElement* queue_;
+    GstElement* sink_;
+
+    std::thread writer_;
+    std::atomic<bool> stopping_;
+    bool failed_;
+
+    uint8_t* staging_;
+    size_t staged_;
+    Segment segment_;
+    uint32_t nextSegment_;
+    uint64_t unalignedBuffers_;
+
+    void writeLoop();
+    void onData(const uint8_t* data, size_t size);
+    bool rotationDue(const uint8_t* packet, std::chrono::steady_clock::duration elapsed) const;
+    bool openSegment();
+    void closeSegment();
+    bool flushStaging(bool padToBlock);
+    void indexPacket(const uint8_t* packet, uint64_t offset);
+    uint32_t findNextSegment() const;
+    std::string segmentPath(uint32_t number, const char* extension) const;
+};
@@ -0,0 +1,257 @@
+#include "Restreamer.h"
+#include "Config.h"
+#include "Logger.h"
+#include "utils/ScopedGLibObject.h"
+#include <chrono>
+
+namespace
+{
+
+uint64_t bufferSize(GstPadProbeInfo* info)
+{
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        return gst_buffer_list_calculate_size(GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+    }
+    return gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+}
+
+uint64_t bufferCount(GstPadProbeInfo* info)
+{
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        return gst_buffer_list_length(GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+    }
+    return 1;
+}
+
+} // namespace
+
+Restreamer::Restreamer(GstBin* bin, const Config& config) : bin_(bin), config_(config), statsTimerId_(0)
+{
+    Branch* udpBranch = nullptr;
+
+    for (const auto& destination : config_.restreamDestinations_)
+    {
+        if (!destination.srt_)
+        {
+            if (!udpBranch)
+            {
+                udpBranch = makeBranch("udp", "multiudpsink");
+                if (!udpBranch)
+                {
+                    continue;
+                }
+            }
+            udpBranch->udpClients_.emplace_back(destination.address_, destination.port_);
+            g_signal_emit_by_name(udpBranch->sink_, "add", destination.address_.c_str(), destination.port_);
+            Logger::log("Restreaming (pass-through) to udp://%s:%u", destination.address_.c_str(), destination.port_);
+            continue;
+        }
+
+        std::string uri = "srt://";
+        uri.append(destination.address_);
+        uri.append(":");
+        uri.append(std::to_string(destination.port_));
+
+        auto srtBranch = makeBranch(uri, "srtsink");
+        if (!srtBranch)
+        {
+            continue;
+        }
+
+        g_object_set(srtBranch->sink_,
+            "uri",
+            uri.c_str(),
+            "mode",
+            1, // GST_SRT_CONNECTION_MODE_CALLER
+            "wait-for-connection",
+            false,
+            "latency",
+            config_.srtSourceLatency_,
+            nullptr);
+        Logger::log("Restreaming (pass-through) to %s", uri.c_str());
+    }
+
+    if (config_.statsInterval_.count() != 0)
+    {
+        statsTimerId_ = g_timeout_add_seconds(config_.statsInterval_.count(), logStatsCallback, this);
+    }
+}
+
+Restreamer::~Restreamer()
+{
+    if (statsTimerId_ != 0)
+    {
+        g_source_remove(statsTimerId_);
+    }
+}
+
+Restreamer::Branch* Restreamer::makeBranch(const std::string& name, const char* sinkFactory)
+{
+    auto branch = std::make_unique<Branch>();
+    branch->name_ = name;
+    branch->queue_ = gst_element_factory_make("queue", nullptr);
+    branch->sink_ = gst_element_factory_make(sinkFactory, nullptr);
+    if (!branch->queue_ || !branch->sink_)
+    {
+        Logger::log("Unable to make restream elements for %s", name.c_str());
+        if (branch->queue_)
+        {
+            gst_object_unref(branch->queue_);
+        }
+        if (branch->sink_)
+        {
+            gst_object_unref(branch->sink_);
+        }
+        return nullptr;
+    }
+
+    // Bounded and leaky, a destination that cannot keep up loses its oldest data instead of blocking the tee
+    g_object_set(branch->queue_,
+        "max-size-buffers",
+        0,
+        "max-size-bytes",
+        0,
+        "max-size-time",
+        std::chrono::nanoseconds(config_.restreamQueueMaxTime_).count(),
+        "leaky",
+        2, // downstream
+        nullptr);
+
+    // A restream destination must never hold back preroll or wait on the clock
+    g_object_set(branch->sink_, "sync", FALSE, "async", FALSE, nullptr);
+
+    gst_bin_add_many(bin_, branch->queue_, branch->sink_, nullptr);
+    branches_.emplace_back(std::move(branch));
+    return branches_.back().get();
+}
+
+bool Restreamer::link(GstElement* tee)
+{
+    g_object_set(tee, "allow-not-linked", TRUE, nullptr);
+
+    for (auto& branch : branches_)
+    {
+        if (!linkBranch(tee, *branch))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Restreamer::linkBranch(GstElement* tee, Branch& branch)
+{
+    if (!gst_element_link_many(tee, branch.queue_, branch.sink_, nullptr))
+    {
+        Logger::log("Restream destination %s could not be linked.", branch.name_.c_str());
+        return false;
+    }
+
+    utils::ScopedGLibObject queueSinkPad(gst_element_get_static_pad(branch.queue_, "sink"));
+    gst_pad_add_probe(queueSinkPad.get(),
+        static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        countInProbe,
+        &branch,
+        nullptr);
+
+    utils::ScopedGLibObject queueSrcPad(gst_element_get_static_pad(branch.queue_, "src"));
+    gst_pad_add_probe(queueSrcPad.get(),
+        static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        countOutProbe,
+        &branch,
+        nullptr);
+
+    return true;
+}
+
+std::vector<Restreamer::DestinationStats> Restreamer::getStats() const
+{
+    std::vector<DestinationStats> result;
+
+    for (const auto& branch : branches_)
+    {
+        guint queuedBuffers = 0;
+        g_object_get(branch->queue_, "current-level-buffers", &queuedBuffers, nullptr);
+        const auto buffersOut = branch->buffersOut_.load() + queuedBuffers;
+        const auto buffersIn = branch->buffersIn_.load();
+        const auto buffersDropped = buffersIn > buffersOut ? buffersIn - buffersOut : 0;
+
+        if (branch->udpClients_.empty())
+        {
+            result.push_back({branch->name_, branch->bytesIn_.load(), branch->bytesOut_.load(), buffersDropped});
+            continue;
+        }
+
+        for (const auto& client : branch->udpClients_)
+        {
+            GstStructure* clientStats = nullptr;
+            g_signal_emit_by_name(branch->sink_, "get-stats", client.first.c_str(), client.second, &clientStats);
+
+            guint64 bytesSent = 0;
+            if (clientStats)
+            {
+                gst_structure_get_uint64(clientStats, "bytes-sent", &bytesSent);
+                gst_structure_free(clientStats);
+            }
+
+            auto name = std::string("udp://") + client.first + ":" + std::to_string(client.second);
+            result.push_back({std::move(name), branch->bytesIn_.load(), bytesSent, buffersDropped});
+        }
+    }
+
+    return result;
+}
+
+void Restreamer::logStats()
+{
+    auto stats = getStats();
+    const auto intervalSeconds = static_cast<double>(config_.statsInterval_.count());
+
+    for (const auto& destination : stats)
+    {
+        uint64_t previousBytesSent = 0;
+        for (const auto& previous : lastStats_)
+        {
+            if (previous.name_ == destination.name_)
+            {
+                previousBytesSent = previous.bytesSent_;
+                break;
+            }
+        }
+
+        const auto kbps = static_cast<double>(destination.bytesSent_ - previousBytesSent) * 8.0 / 1000.0 /
+            intervalSeconds;
+        Logger::log("Restream %s: %.1f kbps, %llu bytes sent, %llu buffers dropped",
+            destination.name_.c_str(),
+            kbps,
+            static_cast<unsigned long long>(destination.bytesSent_),
+            static_cast<unsigned long long>(destination.buffersDropped_));
+    }
+
+    lastStats_ = std::move(stats);
+}
+
+gboolean Restreamer::logStatsCallback(gpointer userData)
+{
+    auto restreamer = reinterpret_cast<Restreamer*>(userData);
+    restreamer->logStats();
+    return G_SOURCE_CONTINUE;
+}
+
+GstPadProbeReturn Restreamer::countInProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto branch = reinterpret_cast<Branch*>(userData);
+    branch->bytesIn_ += bufferSize(info);
+    branch->buffersIn_ += bufferCount(info);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn Restreamer::countOutProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto branch = reinterpret_cast<Branch*>(userData);
+    branch->bytesOut_ += bufferSize(info);
+    branch->buffersOut_ += bufferCount(info);
+    return GST_PAD_PROBE_OK;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <gst/gst.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct Config;
+
+/**
+ * Fans the incoming MPEG-TS out to all configured restream destinations. Every branch hangs off the source tee,
+ * which pushes the same buffer reference to each branch, so the payload is never copied. All UDP destinations share
+ * one multiudpsink that sends each buffer to every client with a single sendmmsg call. Each branch has its own
+ * bounded, leaky queue so a stalled destination drops data instead of back-pressuring the WHIP path.
+ */
+class Restreamer
+{
+public:
+    struct DestinationStats
+    {
+        std::string name_;
+        uint64_t bytesIn_;
+        uint64_t bytesSent_;
+        uint64_t buffersDropped_;
+    };
+
+    Restreamer(GstBin* bin, const Config& config);
+    ~Restreamer();
+
+    bool link(GstElement* tee);
+    std::vector<DestinationStats> getStats() const;
+
+    static gboolean logStatsCallback(gpointer userData);
+
+private:
+    struct Branch
+    {
+        Branch() : queue_(nullptr), sink_(nullptr), bytesIn_(0), bytesOut_(0), buffersIn_(0), buffersOut_(0) {}
+
+        std::string name_;
+        std::vector<std::pair<std::string, uint32_t>> udpClients_;
+        GstElement* queue_;
+        GstElement* sink_;
+        std::atomic<uint64_t> bytesIn_;
+        std::atomic<uint64_t> bytesOut_;
+        std::atomic<uint64_t> buffersIn_;
+        std::atomic<uint64_t> buffersOut_;
+    };
+
+    GstBin* bin_;
+    const Config& config_;
+    std::vector<std::unique_ptr<Branch>> branches_;
+    std::vector<DestinationStats> lastStats_;
+    guint statsTimerId_;
+
+    Branch* makeBranch(const std::string& name, const char* sinkFactory);
+    bool linkBranch(GstElement* tee, Branch& branch);
+    void logStats();
+
+    static GstPadProbeReturn countInProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn countOutProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+};
@@ -0,0 +1,108 @@
+#include "RtpPacer.h"
+#include <algorithm>
+
+namespace
+{
+
+const double pacingFactor = 2.5;
+const gint64 maxPacingDelayUs = 40000;
+const gint64 rateWindowUs = 500000;
+
+} // namespace
+
+RtpPacer::RtpPacer(GstElement* queue)
+    : queue_(queue),
+      srcPad_(gst_element_get_static_pad(queue, "src")),
+      probeId_(0),
+      nextSendTime_(0),
+      rateWindowStart_(0),
+      rateWindowBytes_(0),
+      bitrate_(0)
+{
+    probeId_ = gst_pad_add_probe(srcPad_,
+        static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        bufferProbe,
+        this,
+        nullptr);
+}
+
+RtpPacer::~RtpPacer()
+{
+    gst_pad_remove_probe(srcPad_, probeId_);
+    gst_object_unref(srcPad_);
+}
+
+void RtpPacer::updateBitrate(gint64 now, gsize bytes)
+{
+    if (rateWindowStart_ == 0)
+    {
+        rateWindowStart_ = now;
+    }
+    rateWindowBytes_ += bytes;
+
+    const auto elapsed = now - rateWindowStart_;
+    if (elapsed < rateWindowUs)
+    {
+        return;
+    }
+
+    const auto measuredBitrate = static_cast<double>(rateWindowBytes_) * 8.0 * G_USEC_PER_SEC / elapsed;
+    bitrate_ = bitrate_ == 0 ? measuredBitrate : 0.7 * bitrate_ + 0.3 * measuredBitrate;
+    rateWindowStart_ = now;
+    rateWindowBytes_ = 0;
+}
+
+void RtpPacer::waitForSendTime(gsize bytes)
+{
+    const auto now = g_get_monotonic_time();
+
+    // Never build up more pacing debt than one frame interval
+    nextSendTime_ = std::max(nextSendTime_, now);
+    nextSendTime_ = std::min(nextSendTime_, now + maxPacingDelayUs);
+
+    if (nextSendTime_ > now)
+    {
+        g_usleep(nextSendTime_ - now);
+    }
+    nextSendTime_ += static_cast<gint64>(static_cast<double>(bytes) * 8.0 * G_USEC_PER_SEC / (bitrate_ * pacingFactor));
+}
+
+GstPadProbeReturn RtpPacer::onBufferList(GstPad* pad, GstPadProbeInfo* info)
+{
+    // Each packet passes this probe again on its own, so pauses go in between packets and later probes see them all
+    auto bufferList = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+    auto flowReturn = GST_FLOW_OK;
+    for (guint i = 0; i < gst_buffer_list_length(bufferList) && flowReturn == GST_FLOW_OK; ++i)
+    {
+        flowReturn = gst_pad_push(pad, gst_buffer_ref(gst_buffer_list_get(bufferList, i)));
+    }
+    gst_buffer_list_unref(bufferList);
+
+    GST_PAD_PROBE_INFO_FLOW_RETURN(info) = flowReturn;
+    return GST_PAD_PROBE_HANDLED;
+}
+
+GstPadProbeReturn RtpPacer::bufferProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData)
+{
+    auto pacer = reinterpret_cast<RtpPacer*>(userData);
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        return pacer->onBufferList(pad, info);
+    }
+    const auto bytes = gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+
+    const auto now = g_get_monotonic_time();
+    pacer->updateBitrate(now, bytes);
+
+    // Catch up without pacing while packets are waiting in the queue, or before the bitrate is known
+    guint queuedBuffers = 0;
+    g_object_get(pacer->queue_, "current-level-buffers", &queuedBuffers, nullptr);
+    if (queuedBuffers > 0 || pacer->bitrate_ == 0)
+    {
+        pacer->nextSendTime_ = now;
+        return GST_PAD_PROBE_OK;
+    }
+
+    pacer->waitForSendTime(bytes);
+    return GST_PAD_PROBE_OK;
+}
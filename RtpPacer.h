@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <gst/gst.h>
+
+/**
+ * Paces RTP packets leaving a queue so that a frame's packets are spread out in time instead of being sent as one
+ * burst. Packets are released at 2.5 x the measured media bitrate, the same headroom libwebrtc's pacer uses, so an
+ * average frame occupies well under one frame interval while large key frames are smoothed further. Pacing never
+ * delays a packet by more than maxPacingDelay, and is skipped while the queue holds a backlog, so it cannot add up
+ * latency. It runs in the queue's own streaming thread, buffer lists from the payloader are pushed as single packets.
+ */
+class RtpPacer
+{
+public:
+    explicit RtpPacer(GstElement* queue);
+    ~RtpPacer();
+
+private:
+    GstElement* queue_;
+    GstPad* srcPad_;
+    gulong probeId_;
+
+    gint64 nextSendTime_;
+    gint64 rateWindowStart_;
+    uint64_t rateWindowBytes_;
+    double bitrate_;
+
+    void updateBitrate(gint64 now, gsize bytes);
+    void waitForSendTime(gsize bytes);
+    GstPadProbeReturn onBufferList(GstPad* pad, GstPadProbeInfo* info);
+
+    static GstPadProbeReturn bufferProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData);
+};
@@ -0,0 +1,158 @@
+#include "Scte35Cues.h"
+#include "Logger.h"
+#include "utils/Json.h"
+#include "utils/ScopedGLibMem.h"
+
+namespace
+{
+
+const char* commandName(GstMpegtsSCTESpliceCommandType commandType)
+{
+    switch (commandType)
+    {
+    case GST_MTS_SCTE_SPLICE_COMMAND_NULL:
+        return "splice_null";
+    case GST_MTS_SCTE_SPLICE_COMMAND_SCHEDULE:
+        return "splice_schedule";
+    case GST_MTS_SCTE_SPLICE_COMMAND_INSERT:
+        return "splice_insert";
+    case GST_MTS_SCTE_SPLICE_COMMAND_TIME:
+        return "time_signal";
+    case GST_MTS_SCTE_SPLICE_COMMAND_BANDWIDTH:
+        return "bandwidth_reservation";
+    case GST_MTS_SCTE_SPLICE_COMMAND_PRIVATE:
+        return "private_command";
+    default:
+        return "unknown";
+    }
+}
+
+// Splice and break durations are in 90 kHz units
+double ticksToMs(guint64 ticks)
+{
+    return static_cast<double>(ticks) / 90.0;
+}
+
+std::string runningTimeField(const char* name, const GstMpegtsSCTESIT& sit, bool specified, guint64 spliceTime)
+{
+    if (!specified || !sit.is_running_time)
+    {
+        return utils::Json::field(name, std::string("null"));
+    }
+    return utils::Json::field(name, static_cast<double>(spliceTime) / GST_MSECOND);
+}
+
+} // namespace
+
+Scte35Cues::Scte35Cues(GstElement* parser, MessageSender messageSender, KeyframeForcer keyframeForcer)
+    : sinkPad_(gst_element_get_static_pad(parser, "sink")),
+      probeId_(0),
+      messageSender_(std::move(messageSender)),
+      keyframeForcer_(std::move(keyframeForcer))
+{
+    probeId_ = gst_pad_add_probe(sinkPad_, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, eventProbe, this, nullptr);
+}
+
+Scte35Cues::~Scte35Cues()
+{
+    gst_pad_remove_probe(sinkPad_, probeId_);
+    gst_object_unref(sinkPad_);
+}
+
+void Scte35Cues::onSection(GstMpegtsSection* section)
+{
+    using utils::Json::field;
+    using utils::Json::quote;
+
+    const auto sit = gst_mpegts_section_get_scte_sit(section);
+    if (!sit)
+    {
+        Logger::log("SCTE-35 section could not be parsed");
+        return;
+    }
+
+    // Heartbeats carry nothing for the receiver
+    if (sit->splice_command_type == GST_MTS_SCTE_SPLICE_COMMAND_NULL)
+    {
+        return;
+    }
+
+    std::string events = "[";
+    auto keyframeForced = false;
+    for (guint i = 0; sit->splice_events && i < sit->splice_events->len; ++i)
+    {
+        auto event = reinterpret_cast<const GstMpegtsSCTESpliceEvent*>(g_ptr_array_index(sit->splice_events, i));
+        events.append(events.size() > 1 ? "," : "");
+        events.append("{" + field("id", uint64_t{event->splice_event_id}) + "," +
+            field("cancel", event->splice_event_cancel_indicator == TRUE) + "," +
+            field("outOfNetwork", event->out_of_network_indicator == TRUE) + "," +
+            field("immediate", event->splice_immediate_flag == TRUE) + "," +
+            runningTimeField("spliceTimeMs", *sit, event->program_splice_time_specified, event->program_splice_time) +
+            "," +
+            (event->duration_flag ? field("durationMs", ticksToMs(event->break_duration))
+                                  : field("durationMs", std::string("null"))) +
+            "," + field("autoReturn", event->break_duration_auto_return == TRUE) + "}");
+
+        if (sit->splice_command_type != GST_MTS_SCTE_SPLICE_COMMAND_INSERT || event->splice_event_cancel_indicator)
+        {
+            continue;
+        }
+        if (event->splice_immediate_flag)
+        {
+            keyframeForced = keyframeForcer_(GST_CLOCK_TIME_NONE) || keyframeForced;
+        }
+        else if (event->program_splice_time_specified && sit->is_running_time)
+        {
+            keyframeForced = keyframeForcer_(event->program_splice_time) || keyframeForced;
+        }
+    }
+    events.append("]");
+
+    if (sit->splice_command_type == GST_MTS_SCTE_SPLICE_COMMAND_TIME && sit->splice_time_specified &&
+        sit->is_running_time)
+    {
+        keyframeForced = keyframeForcer_(sit->splice_time);
+    }
+
+    std::string encodedSection = "null";
+    auto data = gst_mpegts_section_get_data(section);
+    if (data)
+    {
+        gsize size = 0;
+        auto bytes = reinterpret_cast<const guint8*>(g_bytes_get_data(data, &size));
+        utils::ScopedGLibMem base64(g_base64_encode(bytes, size));
+        encodedSection = quote(base64.get());
+        g_bytes_unref(data);
+    }
+
+    Logger::log("SCTE-35 %s with %u events%s",
+        commandName(sit->splice_command_type),
+        sit->splice_events ? sit->splice_events->len : 0,
+        keyframeForced ? ", IDR requested at the splice point" : "");
+
+    messageSender_("{" + field("type", "scte35") + "," + field("command", commandName(sit->splice_command_type)) +
+        "," + runningTimeField("spliceTimeMs", *sit, sit->splice_time_specified, sit->splice_time) + "," +
+        field("events", events) + "," + field("section", encodedSection) + "}");
+}
+
+GstPadProbeReturn Scte35Cues::eventProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CUSTOM_DOWNSTREAM)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    auto section = gst_event_parse_mpegts_section(event);
+    if (!section)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (GST_MPEGTS_SECTION_TYPE(section) == GST_MPEGTS_SECTION_SCTE_SIT)
+    {
+        reinterpret_cast<Scte35Cues*>(userData)->onSection(section);
+    }
+    gst_mpegts_section_unref(section);
+    return GST_PAD_PROBE_OK;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <functional>
+#include <gst/gst.h>
+#include <gst/mpegts/mpegts.h>
+#include <string>
+
+/**
+ * SCTE-35 splice information sections arriving as events in front of the video parser. tsdemux sends them with
+ * send-scte35-events, with splice times converted to running time. Each cue is forwarded as one JSON message holding
+ * the parsed splice command and the base64 encoded section, and splice points ask for an IDR at exactly their running
+ * time, so the encoder starts a new GOP on the splice frame instead of the receiver waiting for the next one.
+ */
+class Scte35Cues
+{
+public:
+    using MessageSender = std::function<void(const std::string& message)>;
+    // GST_CLOCK_TIME_NONE asks for the next frame
+    using KeyframeForcer = std::function<bool(GstClockTime runningTime)>;
+
+    Scte35Cues(GstElement* parser, MessageSender messageSender, KeyframeForcer keyframeForcer);
+    ~Scte35Cues();
+
+private:
+    GstPad* sinkPad_;
+    gulong probeId_;
+    MessageSender messageSender_;
+    KeyframeForcer keyframeForcer_;
+
+    void onSection(GstMpegtsSection* section);
+
+    static GstPadProbeReturn eventProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+};
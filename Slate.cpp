@@ -0,0 +1,328 @@
+#include "Slate.h"
+#include "Logger.h"
+#include "utils/ScopedGLibObject.h"
+#include <algorithm>
+#include <chrono>
+#include <gst/app/gstappsink.h>
+
+namespace
+{
+
+const char* slatePipelineDescription =
+    "filesrc name=source ! tsdemux name=demux "
+    "demux. ! queue ! h264parse config-interval=-1 ! video/x-h264,stream-format=byte-stream,alignment=au ! "
+    "appsink name=video sync=false "
+    "demux. ! queue ! opusparse ! appsink name=audio sync=false";
+
+// The whole clip is read ahead of time, a stream that delivers nothing for this long is missing from the file
+const GstClockTime pullTimeout = 5 * GST_SECOND;
+
+// Set on the thread pushing the slate, its buffers pass the payloader probes that gate the source
+thread_local bool pushingSlate = false;
+
+} // namespace
+
+Slate::Slate(const std::string& file)
+    : file_(file),
+      videoCaps_(nullptr),
+      audioCaps_(nullptr),
+      duration_(0),
+      videoOutput_(false),
+      active_(false)
+{
+}
+
+Slate::~Slate()
+{
+    stop();
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+
+    for (auto& output : outputs_)
+    {
+        gst_pad_remove_probe(output->pad_, output->probeId_);
+        gst_object_unref(output->pad_);
+        if (output->sourceCaps_)
+        {
+            gst_caps_unref(output->sourceCaps_);
+        }
+    }
+
+    for (auto& frame : frames_)
+    {
+        gst_buffer_unref(frame.buffer_);
+    }
+    if (videoCaps_)
+    {
+        gst_caps_unref(videoCaps_);
+    }
+    if (audioCaps_)
+    {
+        gst_caps_unref(audioCaps_);
+    }
+}
+
+bool Slate::load()
+{
+    GError* error = nullptr;
+    auto pipeline = gst_parse_launch(slatePipelineDescription, &error);
+    if (!pipeline)
+    {
+        Logger::log("Unable to make slate pipeline: %s", error->message);
+        g_error_free(error);
+        return false;
+    }
+
+    utils::ScopedGLibObject source(gst_bin_get_by_name(GST_BIN(pipeline), "source"));
+    utils::ScopedGLibObject videoSink(gst_bin_get_by_name(GST_BIN(pipeline), "video"));
+    utils::ScopedGLibObject audioSink(gst_bin_get_by_name(GST_BIN(pipeline), "audio"));
+    g_object_set(source.get(), "location", file_.c_str(), nullptr);
+
+    auto result = gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE &&
+        pullFrames(videoSink.get(), true, pullTimeout);
+    if (result)
+    {
+        // Audio was demuxed along with the video, whatever is missing by now is not in the file
+        pullFrames(audioSink.get(), false, GST_SECOND);
+    }
+
+    utils::ScopedGLibObject bus(gst_element_get_bus(pipeline));
+    auto errorMessage = gst_bus_pop_filtered(bus.get(), GST_MESSAGE_ERROR);
+    if (errorMessage)
+    {
+        gst_message_parse_error(errorMessage, &error, nullptr);
+        Logger::log("Unable to read slate %s: %s", file_.c_str(), error->message);
+        g_error_free(error);
+        gst_message_unref(errorMessage);
+        result = false;
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    if (!result || !videoCaps_)
+    {
+        Logger::log("Slate %s has no H264 video", file_.c_str());
+        return false;
+    }
+
+    // Video and audio frames are interleaved in presentation order and timed from the first frame
+    std::stable_sort(frames_.begin(),
+        frames_.end(),
+        [](const Frame& a, const Frame& b) { return GST_BUFFER_PTS(a.buffer_) < GST_BUFFER_PTS(b.buffer_); });
+    const auto firstPts = GST_BUFFER_PTS(frames_.front().buffer_);
+    for (auto& frame : frames_)
+    {
+        GST_BUFFER_PTS(frame.buffer_) -= firstPts;
+        const auto frameDuration =
+            GST_BUFFER_DURATION_IS_VALID(frame.buffer_) ? GST_BUFFER_DURATION(frame.buffer_) : GstClockTime(0);
+        duration_ = std::max(duration_, GST_BUFFER_PTS(frame.buffer_) + frameDuration);
+    }
+
+    Logger::log("Slate %s loaded, %zu frames, %.2f s",
+        file_.c_str(),
+        frames_.size(),
+        static_cast<double>(duration_) / GST_SECOND);
+    return duration_ != 0;
+}
+
+bool Slate::pullFrames(GstElement* appSink, bool video, GstClockTime timeout)
+{
+    for (;;)
+    {
+        auto sample = gst_app_sink_try_pull_sample(GST_APP_SINK(appSink), timeout);
+        if (!sample)
+        {
+            return gst_app_sink_is_eos(GST_APP_SINK(appSink));
+        }
+
+        auto& caps = video ? videoCaps_ : audioCaps_;
+        if (!caps && gst_sample_get_caps(sample))
+        {
+            caps = gst_caps_ref(gst_sample_get_caps(sample));
+        }
+
+        // Frames without timestamps cannot be placed on the timeline, they are dropped
+        auto buffer = gst_sample_get_buffer(sample);
+        if (buffer && GST_BUFFER_PTS_IS_VALID(buffer))
+        {
+            frames_.push_back({gst_buffer_copy(buffer), video});
+        }
+        gst_sample_unref(sample);
+    }
+}
+
+void Slate::addOutput(GstElement* payloader, bool video)
+{
+    auto output = std::make_unique<Output>();
+    output->slate_ = this;
+    output->pad_ = gst_element_get_static_pad(payloader, "sink");
+    output->video_ = video;
+    output->nextSourcePts_ = GST_CLOCK_TIME_NONE;
+    output->ptsBase_ = 0;
+    output->sourceCaps_ = nullptr;
+    output->slateCapsSent_ = false;
+    output->probeId_ = gst_pad_add_probe(output->pad_, GST_PAD_PROBE_TYPE_BUFFER, bufferProbe, output.get(), nullptr);
+    videoOutput_ = videoOutput_ || video;
+    outputs_.push_back(std::move(output));
+}
+
+void Slate::start()
+{
+    if (active_ || frames_.empty())
+    {
+        return;
+    }
+
+    // A previous run is already told to stop, it ends at its next frame
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+
+    for (auto& output : outputs_)
+    {
+        if (output->sourceCaps_)
+        {
+            gst_caps_unref(output->sourceCaps_);
+        }
+        output->sourceCaps_ = gst_pad_get_current_caps(output->pad_);
+        output->slateCapsSent_ = false;
+
+        // Timestamps continue where the source stopped, so the payloaders' RTP timestamps keep running
+        const GstClockTime nextSourcePts = output->nextSourcePts_;
+        if (GST_CLOCK_TIME_IS_VALID(nextSourcePts))
+        {
+            output->ptsBase_ = nextSourcePts;
+        }
+        else
+        {
+            auto payloader = gst_pad_get_parent_element(output->pad_);
+            output->ptsBase_ = payloader ? gst_element_get_current_running_time(payloader) : 0;
+            if (payloader)
+            {
+                gst_object_unref(payloader);
+            }
+        }
+    }
+
+    Logger::log("Source lost, showing slate");
+    active_ = true;
+    thread_ = std::thread(&Slate::pushLoop, this);
+}
+
+void Slate::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(stopMutex_);
+        active_ = false;
+    }
+    stopCondition_.notify_all();
+}
+
+void Slate::pushLoop()
+{
+    pushingSlate = true;
+    const auto startTime = std::chrono::steady_clock::now();
+    for (GstClockTime clipOffset = 0; active_; clipOffset += duration_)
+    {
+        for (const auto& frame : frames_)
+        {
+            const auto pushTime =
+                startTime + std::chrono::nanoseconds(clipOffset + GST_BUFFER_PTS(frame.buffer_));
+            {
+                std::unique_lock<std::mutex> lock(stopMutex_);
+                if (stopCondition_.wait_until(lock, pushTime, [this]() { return !active_; }))
+                {
+                    return;
+                }
+            }
+
+            for (auto& output : outputs_)
+            {
+                if (output->video_ == frame.video_ && !pushFrame(*output, frame, clipOffset))
+                {
+                    stop();
+                    return;
+                }
+            }
+        }
+    }
+}
+
+bool Slate::pushFrame(Output& output, const Frame& frame, GstClockTime clipOffset)
+{
+    if (!output.slateCapsSent_)
+    {
+        // An output the source never fed has no segment yet, the slate's starts at its running time
+        auto segmentEvent = gst_pad_get_sticky_event(output.pad_, GST_EVENT_SEGMENT, 0);
+        if (segmentEvent)
+        {
+            gst_event_unref(segmentEvent);
+        }
+        else
+        {
+            GstSegment segment;
+            gst_segment_init(&segment, GST_FORMAT_TIME);
+            gst_pad_send_event(output.pad_, gst_event_new_stream_start("slate"));
+            gst_pad_send_event(output.pad_, gst_event_new_segment(&segment));
+        }
+        gst_pad_send_event(output.pad_, gst_event_new_caps(output.video_ ? videoCaps_ : audioCaps_));
+        output.slateCapsSent_ = true;
+    }
+
+    // Only the metadata is copied, the encoded data is shared with the loaded clip
+    auto buffer = gst_buffer_copy(frame.buffer_);
+    GST_BUFFER_PTS(buffer) = output.ptsBase_ + clipOffset + GST_BUFFER_PTS(frame.buffer_);
+    GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer);
+
+    const auto flowReturn = gst_pad_chain(output.pad_, buffer);
+    if (flowReturn != GST_FLOW_OK)
+    {
+        Logger::log("Slate stopped, payloader returned %s", gst_flow_get_name(flowReturn));
+        return false;
+    }
+    return true;
+}
+
+GstPadProbeReturn Slate::onSourceBuffer(Output& output, GstBuffer* buffer)
+{
+    if (pushingSlate)
+    {
+        return active_ ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+    }
+
+    if (active_)
+    {
+        // Video switches back at a key frame, audio follows the video or switches at once without video
+        const auto switchBack =
+            output.video_ ? !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) : !videoOutput_;
+        if (!switchBack)
+        {
+            return GST_PAD_PROBE_DROP;
+        }
+        stop();
+        Logger::log("Source is back, leaving slate");
+    }
+
+    // The payloader saw the slate's caps last, the source's have to be sent again
+    if (output.slateCapsSent_.exchange(false) && output.sourceCaps_)
+    {
+        gst_pad_send_event(output.pad_, gst_event_new_caps(output.sourceCaps_));
+    }
+
+    if (GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        output.nextSourcePts_ = GST_BUFFER_PTS(buffer) +
+            (GST_BUFFER_DURATION_IS_VALID(buffer) ? GST_BUFFER_DURATION(buffer) : GstClockTime(0));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn Slate::bufferProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto output = reinterpret_cast<Output*>(userData);
+    return output->slate_->onSourceBuffer(*output, GST_PAD_PROBE_INFO_BUFFER(info));
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <gst/gst.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Pre-encoded H264 and Opus clip shown while the source is lost. The clip is an MPEG-TS file that is demuxed and
+ * parsed into memory once at startup. While active, a thread loops it straight into the RTP payloaders in real time,
+ * with timestamps continuing those of the source, so nothing is decoded or encoded and the RTP streams keep their SSRC,
+ * sequence numbers and timestamps running. The source takes over again with its first key frame reaching the video
+ * payloader. The clip should start with an IDR and have no B-frames.
+ */
+class Slate
+{
+public:
+    explicit Slate(const std::string& file);
+    ~Slate();
+
+    bool load();
+    void addOutput(GstElement* payloader, bool video);
+
+    void start();
+    bool isActive() const { return active_; }
+
+private:
+    struct Frame
+    {
+        GstBuffer* buffer_;
+        bool video_;
+    };
+
+    // One payloader input, shared between the source and the slate
+    struct Output
+    {
+        Slate* slate_;
+        GstPad* pad_;
+        gulong probeId_;
+        bool video_;
+        std::atomic<GstClockTime> nextSourcePts_;
+        GstClockTime ptsBase_;
+        GstCaps* sourceCaps_;
+        std::atomic<bool> slateCapsSent_;
+    };
+
+    std::string file_;
+    std::vector<Frame> frames_;
+    GstCaps* videoCaps_;
+    GstCaps* audioCaps_;
+    GstClockTime duration_;
+
+    std::vector<std::unique_ptr<Output>> outputs_;
+    bool videoOutput_;
+    std::thread thread_;
+    std::atomic<bool> active_;
+    std::mutex stopMutex_;
+    std::condition_variable stopCondition_;
+
+    void stop();
+    void pushLoop();
+    bool pullFrames(GstElement* appSink, bool video, GstClockTime timeout);
+    bool pushFrame(Output& output, const Frame& frame, GstClockTime clipOffset);
+    GstPadProbeReturn onSourceBuffer(Output& output, GstBuffer* buffer);
+
+    static GstPadProbeReturn bufferProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+};
@@ -0,0 +1,385 @@
+#include "SrtListener.h"
+#include "http/WhipClient.h"
+#include "Logger.h"
+#include "Pipeline.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <fstream>
+#include <netdb.h>
+#include <sstream>
+
+namespace
+{
+
+// Largest payload of one SRT live mode message
+const size_t srtMessageSize = 1456;
+
+} // namespace
+
+SrtListener::SrtListener(const Config& config)
+    : config_(config),
+      listenSocket_(SRT_INVALID_SOCK),
+      stopping_(false),
+      statsTimerId_(0)
+{
+    srt_startup();
+}
+
+SrtListener::~SrtListener()
+{
+    stop();
+    srt_cleanup();
+}
+
+bool SrtListener::loadStreamIdMap()
+{
+    std::ifstream mapFile(config_.srtStreamIdMap_);
+    if (!mapFile.is_open())
+    {
+        Logger::log("Unable to open SRT stream id map %s", config_.srtStreamIdMap_.c_str());
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(mapFile, line))
+    {
+        std::istringstream lineStream(line);
+        std::string streamId;
+        Endpoint endpoint;
+        if (!(lineStream >> streamId) || streamId[0] == '#')
+        {
+            continue;
+        }
+
+        if (!(lineStream >> endpoint.url_))
+        {
+            Logger::log("SRT stream id %s has no WHIP endpoint, ignored", streamId.c_str());
+            continue;
+        }
+        lineStream >> endpoint.authKey_;
+
+        Logger::log("SRT stream id %s -> %s", streamId.c_str(), endpoint.url_.c_str());
+        endpoints_[streamId] = std::move(endpoint);
+    }
+
+    return !endpoints_.empty();
+}
+
+const SrtListener::Endpoint* SrtListener::findEndpoint(const std::string& streamId) const
+{
+    auto findResult = endpoints_.find(streamId);
+    if (findResult == endpoints_.cend())
+    {
+        findResult = endpoints_.find("*");
+    }
+
+    return findResult == endpoints_.cend() ? nullptr : &findResult->second;
+}
+
+bool SrtListener::start()
+{
+    if (!loadStreamIdMap())
+    {
+        Logger::log("No SRT stream id routes configured");
+        return false;
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* localAddress = nullptr;
+    const auto port = std::to_string(config_.udpSourcePort_);
+    if (getaddrinfo(config_.udpSourceAddress_.c_str(), port.c_str(), &hints, &localAddress) != 0)
+    {
+        Logger::log("Unable to resolve SRT listen address %s", config_.udpSourceAddress_.c_str());
+        return false;
+    }
+
+    listenSocket_ = srt_create_socket();
+    int32_t latency = config_.srtSourceLatency_;
+    srt_setsockflag(listenSocket_, SRTO_LATENCY, &latency, sizeof(latency));
+
+    const auto bindResult = srt_bind(listenSocket_, localAddress->ai_addr, localAddress->ai_addrlen);
+    freeaddrinfo(localAddress);
+    if (bindResult == SRT_ERROR || srt_listen_callback(listenSocket_, listenCallback, this) == SRT_ERROR ||
+        srt_listen(listenSocket_, 16) == SRT_ERROR)
+    {
+        Logger::log("Unable to listen for SRT callers: %s", srt_getlasterror_str());
+        srt_close(listenSocket_);
+        listenSocket_ = SRT_INVALID_SOCK;
+        return false;
+    }
+
+    Logger::log("SRT listener accepting callers on %s:%u",
+        config_.udpSourceAddress_.c_str(),
+        config_.udpSourcePort_);
+    acceptThread_ = std::thread(&SrtListener::acceptLoop, this);
+
+    if (config_.statsInterval_.count() != 0)
+    {
+        statsTimerId_ = g_timeout_add_seconds(config_.statsInterval_.count(), statsTimerCallback, this);
+    }
+    return true;
+}
+
+void SrtListener::stop()
+{
+    if (stopping_.exchange(true))
+    {
+        return;
+    }
+
+    if (statsTimerId_ != 0)
+    {
+        g_source_remove(statsTimerId_);
+        statsTimerId_ = 0;
+    }
+
+    if (listenSocket_ != SRT_INVALID_SOCK)
+    {
+        // Closing the listener wakes up the blocking srt_accept
+        srt_close(listenSocket_);
+        listenSocket_ = SRT_INVALID_SOCK;
+    }
+    if (acceptThread_.joinable())
+    {
+        acceptThread_.join();
+    }
+
+    std::lock_guard<std::mutex> lock(callersMutex_);
+    for (auto& caller : callers_)
+    {
+        closeCaller(*caller.second);
+    }
+    callers_.clear();
+}
+
+void SrtListener::acceptLoop()
+{
+    while (!stopping_)
+    {
+        sockaddr_storage peerAddress = {};
+        int peerAddressLength = sizeof(peerAddress);
+        const auto socket = srt_accept(listenSocket_, reinterpret_cast<sockaddr*>(&peerAddress), &peerAddressLength);
+        if (socket == SRT_INVALID_SOCK)
+        {
+            if (!stopping_)
+            {
+                Logger::log("SRT accept failed: %s", srt_getlasterror_str());
+            }
+            break;
+        }
+
+        std::array<char, 513> streamId{};
+        int streamIdLength = streamId.size() - 1;
+        srt_getsockflag(socket, SRTO_STREAMID, streamId.data(), &streamIdLength);
+
+        // Pipelines are created and destroyed on the main loop only
+        g_idle_add(callerAcceptedCallback, new CallerEvent{this, socket, std::string(streamId.data(), streamIdLength)});
+    }
+}
+
+void SrtListener::onCallerAccepted(SRTSOCKET socket, const std::string& streamId)
+{
+    if (stopping_)
+    {
+        srt_close(socket);
+        return;
+    }
+
+    auto endpoint = findEndpoint(streamId);
+    std::lock_guard<std::mutex> lock(callersMutex_);
+    for (const auto& caller : callers_)
+    {
+        if (caller.second->streamId_ == streamId)
+        {
+            endpoint = nullptr;
+            Logger::log("SRT stream id %s is already connected, rejecting caller", streamId.c_str());
+            break;
+        }
+    }
+
+    if (!endpoint)
+    {
+        srt_close(socket);
+        return;
+    }
+
+    Logger::log("SRT caller connected, stream id %s -> %s", streamId.c_str(), endpoint->url_.c_str());
+
+    auto caller = std::make_unique<Caller>();
+    caller->socket_ = socket;
+    caller->streamId_ = streamId;
+    caller->config_ = config_;
+    caller->config_.whipEndpointUrl_ = endpoint->url_;
+    caller->config_.whipEndpointAuthKey_ = endpoint->authKey_;
+    caller->config_.applicationSource_ = true;
+    // Every caller would restream to the same destinations, restreaming is only supported for a single source
+    caller->config_.restreamDestinations_.clear();
+    // Each caller records into its own ring, in a subdirectory named after its stream id
+    if (!caller->config_.recordDirectory_.empty())
+    {
+        std::string directoryName = streamId.empty() ? std::string("default") : streamId;
+        std::replace_if(directoryName.begin(),
+            directoryName.end(),
+            [](char character)
+            { return !std::isalnum(static_cast<unsigned char>(character)) && character != '-' && character != '_'; },
+            '_');
+        caller->config_.recordDirectory_ += "/" + directoryName;
+    }
+
+    caller->whipClient_ = std::make_unique<http::WhipClient>(caller->config_.whipEndpointUrl_,
+        caller->config_.whipEndpointAuthKey_);
+    caller->pipeline_ = std::make_unique<Pipeline>(*caller->whipClient_, caller->config_);
+    caller->pipeline_->run();
+    caller->reader_ = std::thread(&SrtListener::readLoop, this, caller.get());
+
+    callers_.emplace(socket, std::move(caller));
+}
+
+void SrtListener::readLoop(Caller* caller)
+{
+    std::array<char, srtMessageSize> message{};
+
+    while (true)
+    {
+        const auto messageSize = srt_recvmsg(caller->socket_, message.data(), message.size());
+        if (messageSize == SRT_ERROR || messageSize == 0)
+        {
+            break;
+        }
+
+        caller->pipeline_->pushSourceData(reinterpret_cast<const uint8_t*>(message.data()), messageSize);
+    }
+
+    if (stopping_)
+    {
+        return;
+    }
+
+    Logger::log("SRT caller %s disconnected", caller->streamId_.c_str());
+    caller->pipeline_->endOfSource();
+    g_idle_add(callerClosedCallback, new CallerEvent{this, caller->socket_, caller->streamId_});
+}
+
+void SrtListener::onCallerClosed(SRTSOCKET socket)
+{
+    std::lock_guard<std::mutex> lock(callersMutex_);
+    auto findResult = callers_.find(socket);
+    if (findResult == callers_.end())
+    {
+        return;
+    }
+
+    closeCaller(*findResult->second);
+    callers_.erase(findResult);
+}
+
+void SrtListener::closeCaller(Caller& caller)
+{
+    srt_close(caller.socket_);
+    if (caller.reader_.joinable())
+    {
+        caller.reader_.join();
+    }
+
+    const auto& whipResource = caller.pipeline_->getWhipResource();
+    caller.pipeline_->stop();
+    if (!whipResource.empty())
+    {
+        Logger::log("Deleting WHIP session: %s", whipResource.c_str());
+        caller.whipClient_->deleteSession(whipResource);
+    }
+}
+
+void SrtListener::forEachPipeline(
+    const std::function<void(const std::string& streamId, Pipeline& pipeline)>& function)
+{
+    std::lock_guard<std::mutex> lock(callersMutex_);
+    for (auto& callerEntry : callers_)
+    {
+        function(callerEntry.second->streamId_, *callerEntry.second->pipeline_);
+    }
+}
+
+void SrtListener::onStatsTimer()
+{
+    std::lock_guard<std::mutex> lock(callersMutex_);
+    for (auto& callerEntry : callers_)
+    {
+        auto& caller = *callerEntry.second;
+        SrtStatistics statistics;
+        if (!SrtStatistics::fromSocket(caller.socket_, statistics))
+        {
+            continue;
+        }
+        Logger::log("SRT caller %s: %s", caller.streamId_.c_str(), statistics.toString().c_str());
+
+        if (!config_.srtLatencyAutoTune_ || caller.latencyTuned_ || statistics.rttMs_ <= 0)
+        {
+            continue;
+        }
+        caller.latencyTuned_ = true;
+
+        const auto latency = srtLatencyFromRtt(statistics.rttMs_, config_);
+        if (static_cast<int32_t>(latency) != statistics.latencyMs_)
+        {
+            Logger::log("SRT caller %s latency %d ms -> %u ms from measured rtt %.1f ms, applied on reconnect",
+                caller.streamId_.c_str(),
+                statistics.latencyMs_,
+                latency,
+                statistics.rttMs_);
+        }
+
+        std::lock_guard<std::mutex> latencyLock(latencyMutex_);
+        tunedLatency_[caller.streamId_] = latency;
+    }
+}
+
+int SrtListener::listenCallback(void* userData,
+    SRTSOCKET socket,
+    int /*hsVersion*/,
+    const struct sockaddr* /*peerAddress*/,
+    const char* streamId)
+{
+    auto listener = reinterpret_cast<SrtListener*>(userData);
+    const std::string streamIdString(streamId ? streamId : "");
+    if (!listener->findEndpoint(streamIdString))
+    {
+        Logger::log("Rejecting SRT caller with unknown stream id %s", streamIdString.c_str());
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(listener->latencyMutex_);
+    const auto tunedLatency = listener->tunedLatency_.find(streamIdString);
+    if (tunedLatency != listener->tunedLatency_.cend())
+    {
+        // Still before the handshake completes, so the latency is negotiated with this value
+        int32_t latency = tunedLatency->second;
+        srt_setsockflag(socket, SRTO_RCVLATENCY, &latency, sizeof(latency));
+    }
+    return 0;
+}
+
+gboolean SrtListener::callerAcceptedCallback(gpointer userData)
+{
+    std::unique_ptr<CallerEvent> event(reinterpret_cast<CallerEvent*>(userData));
+    event->listener_->onCallerAccepted(event->socket_, event->streamId_);
+    return G_SOURCE_REMOVE;
+}
+
+gboolean SrtListener::statsTimerCallback(gpointer userData)
+{
+    auto listener = reinterpret_cast<SrtListener*>(userData);
+    listener->onStatsTimer();
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean SrtListener::callerClosedCallback(gpointer userData)
+{
+    std::unique_ptr<CallerEvent> event(reinterpret_cast<CallerEvent*>(userData));
+    event->listener_->onCallerClosed(event->socket_);
+    return G_SOURCE_REMOVE;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Config.h"
+#include "SrtStatistics.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <glib.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <srt/srt.h>
+#include <string>
+#include <thread>
+
+class Pipeline;
+
+namespace http
+{
+class WhipClient;
+}
+
+/**
+ * SRT listener that accepts any number of callers on one port. Each caller is routed by its SRT stream id, looked up
+ * in the mapping table given by Config::srtStreamIdMap_, to its own Pipeline and WHIP endpoint. Callers with an
+ * unknown stream id are rejected during the handshake.
+ *
+ * Mapping table format, one entry per line: <streamid> <whipEndpointUrl> [whipEndpointAuthKey]. The stream id "*"
+ * matches any caller without an entry of its own.
+ */
+class SrtListener
+{
+public:
+    explicit SrtListener(const Config& config);
+    ~SrtListener();
+
+    bool start();
+    void stop();
+
+    // Runs on the main loop, like the creation and destruction of the callers' pipelines
+    void forEachPipeline(const std::function<void(const std::string& streamId, Pipeline& pipeline)>& function);
+
+private:
+    struct Endpoint
+    {
+        std::string url_;
+        std::string authKey_;
+    };
+
+    struct Caller
+    {
+        Caller() : socket_(SRT_INVALID_SOCK), latencyTuned_(false) {}
+
+        SRTSOCKET socket_;
+        bool latencyTuned_;
+        std::string streamId_;
+        Config config_;
+        std::unique_ptr<http::WhipClient> whipClient_;
+        std::unique_ptr<Pipeline> pipeline_;
+        std::thread reader_;
+    };
+
+    struct CallerEvent
+    {
+        SrtListener* listener_;
+        SRTSOCKET socket_;
+        std::string streamId_;
+    };
+
+    const Config& config_;
+    std::map<std::string, Endpoint> endpoints_;
+    SRTSOCKET listenSocket_;
+    std::thread acceptThread_;
+    std::atomic<bool> stopping_;
+    guint statsTimerId_;
+
+    // Latency picked from the measured RTT of a stream id, applied when that stream id connects again
+    std::mutex latencyMutex_;
+    std::map<std::string, uint32_t> tunedLatency_;
+
+    std::mutex callersMutex_;
+    std::map<SRTSOCKET, std::unique_ptr<Caller>> callers_;
+
+    bool loadStreamIdMap();
+    const Endpoint* findEndpoint(const std::string& streamId) const;
+    void acceptLoop();
+    void readLoop(Caller* caller);
+    void onCallerAccepted(SRTSOCKET socket, const std::string& streamId);
+    void onCallerClosed(SRTSOCKET socket);
+    void closeCaller(Caller& caller);
+    void onStatsTimer();
+
+    static int listenCallback(void* userData,
+        SRTSOCKET socket,
+        int /*hsVersion*/,
+        const struct sockaddr* /*peerAddress*/,
+        const char* streamId);
+    static gboolean callerAcceptedCallback(gpointer userData);
+    static gboolean callerClosedCallback(gpointer userData);
+    static gboolean statsTimerCallback(gpointer userData);
+};
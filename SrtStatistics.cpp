@@ -0,0 +1,116 @@
+#include "SrtStatistics.h"
+#include "Config.h"
+#include <algorithm>
+#include <array>
+
+namespace
+{
+
+// The srtsrc stats field types differ between GStreamer versions, read every numeric field through a double
+double getNumber(const GstStructure* structure, const char* fieldName)
+{
+    const auto value = gst_structure_get_value(structure, fieldName);
+    if (!value || !g_value_type_transformable(G_VALUE_TYPE(value), G_TYPE_DOUBLE))
+    {
+        return 0;
+    }
+
+    GValue doubleValue = G_VALUE_INIT;
+    g_value_init(&doubleValue, G_TYPE_DOUBLE);
+    g_value_transform(value, &doubleValue);
+    const auto result = g_value_get_double(&doubleValue);
+    g_value_unset(&doubleValue);
+    return result;
+}
+
+const uint32_t rttLatencyMultiplier = 4;
+
+} // namespace
+
+bool SrtStatistics::fromStructure(const GstStructure* structure, SrtStatistics& statistics)
+{
+    if (!structure)
+    {
+        return false;
+    }
+
+    // In listener mode the per connection statistics are in a list of callers, use the first one
+    const auto callers = gst_structure_get_value(structure, "callers");
+    if (callers && G_VALUE_HOLDS(callers, G_TYPE_VALUE_ARRAY))
+    {
+        auto callersArray = reinterpret_cast<GValueArray*>(g_value_get_boxed(callers));
+        if (!callersArray || callersArray->n_values == 0)
+        {
+            return false;
+        }
+        structure = gst_value_get_structure(&callersArray->values[0]);
+        if (!structure)
+        {
+            return false;
+        }
+    }
+
+    statistics.rttMs_ = getNumber(structure, "rtt-ms");
+    statistics.packetsReceived_ = static_cast<int64_t>(getNumber(structure, "packets-received"));
+    statistics.packetsLost_ = static_cast<int64_t>(getNumber(structure, "packets-received-lost"));
+    statistics.packetsRetransmitted_ = static_cast<int64_t>(getNumber(structure, "packets-received-retransmitted"));
+    statistics.packetsDropped_ = static_cast<int64_t>(getNumber(structure, "packets-received-dropped"));
+    statistics.bytesReceived_ = static_cast<uint64_t>(getNumber(structure, "bytes-received"));
+    statistics.receiveRateMbps_ = getNumber(structure, "receive-rate-mbps");
+    statistics.bandwidthMbps_ = getNumber(structure, "bandwidth-mbps");
+    statistics.latencyMs_ = static_cast<int32_t>(getNumber(structure, "negotiated-latency-ms"));
+    statistics.receiveBufferMs_ = static_cast<int32_t>(getNumber(structure, "receive-buffer-ms"));
+    return true;
+}
+
+bool SrtStatistics::fromSocket(SRTSOCKET socket, SrtStatistics& statistics)
+{
+    SRT_TRACEBSTATS performance = {};
+    if (srt_bstats(socket, &performance, 0) == SRT_ERROR)
+    {
+        return false;
+    }
+
+    statistics.rttMs_ = performance.msRTT;
+    statistics.packetsReceived_ = performance.pktRecvTotal;
+    statistics.packetsLost_ = performance.pktRcvLossTotal;
+    statistics.packetsRetransmitted_ = performance.pktRcvRetrans;
+    statistics.packetsDropped_ = performance.pktRcvDropTotal;
+    statistics.bytesReceived_ = performance.byteRecvTotal;
+    statistics.receiveRateMbps_ = performance.mbpsRecvRate;
+    statistics.bandwidthMbps_ = performance.mbpsBandwidth;
+    statistics.latencyMs_ = performance.msRcvTsbPdDelay;
+    statistics.receiveBufferMs_ = performance.msRcvBuf;
+    return true;
+}
+
+std::string SrtStatistics::toString() const
+{
+    std::array<char, 512> result{};
+    snprintf(result.data(),
+        result.size(),
+        "rtt %.1f ms, latency %d ms, receive buffer %d ms, received %lld packets (%llu bytes, %.2f Mbps), "
+        "lost %lld, retransmitted %lld, dropped %lld, bandwidth %.2f Mbps",
+        rttMs_,
+        latencyMs_,
+        receiveBufferMs_,
+        static_cast<long long>(packetsReceived_),
+        static_cast<unsigned long long>(bytesReceived_),
+        receiveRateMbps_,
+        static_cast<long long>(packetsLost_),
+        static_cast<long long>(packetsRetransmitted_),
+        static_cast<long long>(packetsDropped_),
+        bandwidthMbps_);
+    return result.data();
+}
+
+uint32_t srtLatencyFromRtt(double rttMs, const Config& config)
+{
+    if (rttMs <= 0)
+    {
+        return 0;
+    }
+
+    const auto latency = static_cast<uint32_t>(rttMs * rttLatencyMultiplier);
+    return std::min(std::max(latency, config.srtLatencyMin_), config.srtLatencyMax_);
+}
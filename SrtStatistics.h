@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <gst/gst.h>
+#include <srt/srt.h>
+#include <string>
+
+struct Config;
+
+/**
+ * Receiver side statistics of one SRT connection, either read from the srtsrc "stats" property or directly from a
+ * libsrt socket. Counters the srtsrc version in use does not export are left at 0.
+ */
+struct SrtStatistics
+{
+    SrtStatistics()
+        : rttMs_(0),
+          packetsReceived_(0),
+          packetsLost_(0),
+          packetsRetransmitted_(0),
+          packetsDropped_(0),
+          bytesReceived_(0),
+          receiveRateMbps_(0),
+          bandwidthMbps_(0),
+          latencyMs_(0),
+          receiveBufferMs_(0)
+    {
+    }
+
+    static bool fromStructure(const GstStructure* structure, SrtStatistics& statistics);
+    static bool fromSocket(SRTSOCKET socket, SrtStatistics& statistics);
+
+    std::string toString() const;
+
+    double rttMs_;
+    int64_t packetsReceived_;
+    int64_t packetsLost_;
+    int64_t packetsRetransmitted_;
+    int64_t packetsDropped_;
+    uint64_t bytesReceived_;
+    double receiveRateMbps_;
+    double bandwidthMbps_;
+    int32_t latencyMs_;
+    int32_t receiveBufferMs_;
+};
+
+/**
+ * SRT latency to use for a link with the given round trip time, 4 x RTT clamped to the configured bounds. Returns 0
+ * when the RTT is unknown.
+ */
+uint32_t srtLatencyFromRtt(double rttMs, const Config& config);
@@ -0,0 +1,189 @@
+#include "ThreadBudget.h"
+#include "Config.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+
+namespace
+{
+
+std::atomic<uint32_t> channelCount(0);
+
+// Kernel cpu list format, e.g. "0-3,8,10-11"
+std::vector<int32_t> parseCpuList(const std::string& cpuList)
+{
+    std::vector<int32_t> result;
+    size_t start = 0;
+    while (start < cpuList.size())
+    {
+        const auto end = std::min(cpuList.find(',', start), cpuList.size());
+        const auto range = cpuList.substr(start, end - start);
+        const auto dash = range.find('-');
+        const auto first = std::strtol(range.c_str(), nullptr, 10);
+        const auto last = dash == std::string::npos ? first : std::strtol(range.c_str() + dash + 1, nullptr, 10);
+        for (auto cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+        {
+            result.push_back(static_cast<int32_t>(cpu));
+        }
+        start = end + 1;
+    }
+    return result;
+}
+
+std::vector<int32_t> numaNodeCpus(int32_t node)
+{
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string cpuList;
+    if (!file || !std::getline(file, cpuList))
+    {
+        Logger::log("Unable to read CPUs of NUMA node %d", node);
+        return {};
+    }
+    return parseCpuList(cpuList);
+}
+
+uint32_t processThreadCount()
+{
+    std::ifstream file("/proc/self/status");
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.compare(0, 8, "Threads:") == 0)
+        {
+            return std::strtoul(line.c_str() + 8, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+ThreadBudget::ThreadBudget(const Config& config) : config_(config), priorityFailed_(false)
+{
+    if (!config_.cpuSet_.empty())
+    {
+        cpus_ = parseCpuList(config_.cpuSet_);
+    }
+    if (config_.numaNode_ >= 0)
+    {
+        const auto nodeCpus = numaNodeCpus(config_.numaNode_);
+        if (cpus_.empty())
+        {
+            cpus_ = nodeCpus;
+        }
+        else
+        {
+            std::vector<int32_t> intersection;
+            for (auto cpu : cpus_)
+            {
+                if (std::find(nodeCpus.cbegin(), nodeCpus.cend(), cpu) != nodeCpus.cend())
+                {
+                    intersection.push_back(cpu);
+                }
+            }
+            cpus_ = intersection;
+        }
+    }
+
+    const auto channel = channelCount++;
+    if (config_.cpusPerChannel_ != 0 && config_.cpusPerChannel_ < cpus_.size())
+    {
+        std::vector<int32_t> slice;
+        for (uint32_t i = 0; i < config_.cpusPerChannel_; ++i)
+        {
+            slice.push_back(cpus_[(channel * config_.cpusPerChannel_ + i) % cpus_.size()]);
+        }
+        cpus_ = slice;
+    }
+
+    for (auto cpu : cpus_)
+    {
+        cpuList_.append(cpuList_.empty() ? "" : ",");
+        cpuList_.append(std::to_string(cpu));
+    }
+    if (!cpus_.empty())
+    {
+        Logger::log("Channel %u pinned to CPUs %s", channel, cpuList_.c_str());
+    }
+}
+
+void ThreadBudget::onStreamStatus(GstStreamStatusType type, GstElement* owner, bool ingest)
+{
+    if (type != GST_STREAM_STATUS_TYPE_ENTER && type != GST_STREAM_STATUS_TYPE_LEAVE)
+    {
+        return;
+    }
+
+    const std::string name = owner ? GST_ELEMENT_NAME(owner) : "unknown";
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex_);
+        if (type == GST_STREAM_STATUS_TYPE_LEAVE)
+        {
+            auto findResult = threads_.find(name);
+            if (findResult != threads_.end() && --findResult->second == 0)
+            {
+                threads_.erase(findResult);
+            }
+            return;
+        }
+        ++threads_[name];
+    }
+
+    // ENTER is posted from the new streaming thread itself
+    if (!cpus_.empty())
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (auto cpu : cpus_)
+        {
+            CPU_SET(cpu, &cpuSet);
+        }
+        if (sched_setaffinity(0, sizeof(cpuSet), &cpuSet) != 0)
+        {
+            Logger::log("Unable to pin %s thread: %s", name.c_str(), strerror(errno));
+        }
+    }
+
+    if (ingest && config_.ingestPriority_ != 0 && !priorityFailed_)
+    {
+        sched_param param{};
+        param.sched_priority = static_cast<int>(config_.ingestPriority_);
+        const auto result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (result != 0)
+        {
+            // Typically missing CAP_SYS_NICE, no point in trying again for every thread
+            Logger::log("Unable to set real-time priority for %s thread: %s", name.c_str(), strerror(result));
+            priorityFailed_ = true;
+        }
+    }
+}
+
+void ThreadBudget::logReport()
+{
+    std::string report;
+    uint32_t total = 0;
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex_);
+        for (const auto& thread : threads_)
+        {
+            report.append(report.empty() ? "" : ", ");
+            report.append(thread.first);
+            if (thread.second > 1)
+            {
+                report.append(" x");
+                report.append(std::to_string(thread.second));
+            }
+            total += thread.second;
+        }
+    }
+
+    Logger::log("Threads: %u streaming (%s), %u in process, CPUs %s",
+        total,
+        report.c_str(),
+        processThreadCount(),
+        cpuList_.empty() ? "any" : cpuList_.c_str());
+}
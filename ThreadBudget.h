@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <gst/gst.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct Config;
+
+/**
+ * Keeps the threads of one channel within its budget. Every GStreamer streaming thread announces itself with a
+ * STREAM_STATUS message from inside the new thread, which is pinned to the channel's CPUs there, and ingest threads
+ * are raised to real-time priority. Encoder and decoder worker threads are created by the streaming thread that runs
+ * them and inherit its affinity. With Config::cpusPerChannel_ set, channels take consecutive slices of the CPU set
+ * in the order they are created, so many channels spread over the machine instead of all competing for every core.
+ */
+class ThreadBudget
+{
+public:
+    explicit ThreadBudget(const Config& config);
+
+    void onStreamStatus(GstStreamStatusType type, GstElement* owner, bool ingest);
+    void logReport();
+
+private:
+    const Config& config_;
+    std::vector<int32_t> cpus_;
+    std::string cpuList_;
+    std::atomic<bool> priorityFailed_;
+
+    std::mutex threadsMutex_;
+    std::map<std::string, uint32_t> threads_;
+};
@@ -0,0 +1,153 @@
+#include "TimedMetadata.h"
+#include "Logger.h"
+#include "utils/Json.h"
+#include "utils/ScopedGLibMem.h"
+
+namespace
+{
+
+// At most 10 messages per second, metadata can trail the video by up to this much
+const guint batchIntervalMs = 100;
+
+// Larger batches are split, messages above 16 KiB are not delivered by every SCTP implementation
+const size_t maxMessageSize = 16 * 1024;
+
+} // namespace
+
+TimedMetadata::TimedMetadata(GstElement* videoPayloader, MessageSender messageSender)
+    : videoPayloader_(videoPayloader),
+      messageSender_(std::move(messageSender)),
+      batchTimerId_(0)
+{
+    batchTimerId_ = g_timeout_add(batchIntervalMs, batchTimerCallback, this);
+}
+
+TimedMetadata::~TimedMetadata()
+{
+    g_source_remove(batchTimerId_);
+}
+
+bool TimedMetadata::isMetadata(const char* capsName)
+{
+    return g_str_has_prefix(capsName, "meta/x-klv") || g_str_has_prefix(capsName, "meta/x-id3");
+}
+
+void TimedMetadata::attach(GstPad* demuxPad, const char* capsName)
+{
+    // Nothing is linked to the pad, the probe takes each buffer and drops it
+    Logger::log("Forwarding %s stream %s on the metadata data channel", capsName, GST_PAD_NAME(demuxPad));
+    gst_pad_add_probe(demuxPad, GST_PAD_PROBE_TYPE_BUFFER, bufferProbe, this, nullptr);
+}
+
+void TimedMetadata::onBuffer(GstPad* pad, GstBuffer* buffer)
+{
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        return;
+    }
+
+    auto runningTime = GST_CLOCK_TIME_NONE;
+    auto segmentEvent = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+    if (segmentEvent)
+    {
+        const GstSegment* segment = nullptr;
+        gst_event_parse_segment(segmentEvent, &segment);
+        runningTime = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+        gst_event_unref(segmentEvent);
+    }
+
+    GstMapInfo mapInfo;
+    if (!gst_buffer_map(buffer, &mapInfo, GST_MAP_READ))
+    {
+        return;
+    }
+    utils::ScopedGLibMem base64(g_base64_encode(mapInfo.data, mapInfo.size));
+    gst_buffer_unmap(buffer, &mapInfo);
+
+    auto format = "id3";
+    auto caps = gst_pad_get_current_caps(pad);
+    if (caps)
+    {
+        if (g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "meta/x-klv"))
+        {
+            format = "klv";
+        }
+        gst_caps_unref(caps);
+    }
+
+    std::lock_guard<std::mutex> lock(itemsMutex_);
+    items_.push_back({GST_PAD_NAME(pad), format, runningTime, base64.get()});
+}
+
+void TimedMetadata::sendBatch()
+{
+    std::vector<Item> items;
+    {
+        std::lock_guard<std::mutex> lock(itemsMutex_);
+        items.swap(items_);
+    }
+    if (items.empty())
+    {
+        return;
+    }
+
+    // The video payloader's last packet pairs a running time with an RTP timestamp, the items are placed relative to it
+    guint clockRate = 0;
+    guint64 payloaderRunningTime = GST_CLOCK_TIME_NONE;
+    guint payloaderTimestamp = 0;
+    if (videoPayloader_)
+    {
+        GstStructure* stats = nullptr;
+        g_object_get(videoPayloader_, "stats", &stats, nullptr);
+        if (stats)
+        {
+            gst_structure_get_uint(stats, "clock-rate", &clockRate);
+            gst_structure_get_uint64(stats, "running-time", &payloaderRunningTime);
+            gst_structure_get_uint(stats, "timestamp", &payloaderTimestamp);
+            gst_structure_free(stats);
+        }
+    }
+
+    using utils::Json::field;
+    using utils::Json::quote;
+    std::string message;
+    for (const auto& item : items)
+    {
+        std::string rtpTimestamp = "null";
+        if (clockRate != 0 && GST_CLOCK_TIME_IS_VALID(payloaderRunningTime) &&
+            GST_CLOCK_TIME_IS_VALID(item.runningTime_))
+        {
+            // RTP timestamps wrap around, the offset is applied modulo 2^32
+            const auto offset = static_cast<int64_t>(item.runningTime_) - static_cast<int64_t>(payloaderRunningTime);
+            const auto ticks = offset * static_cast<int64_t>(clockRate) / static_cast<int64_t>(GST_SECOND);
+            rtpTimestamp = std::to_string(static_cast<uint32_t>(payloaderTimestamp + ticks));
+        }
+
+        const auto entry = "{" + field("stream", quote(item.stream_)) + "," + field("format", item.format_) + "," +
+            (GST_CLOCK_TIME_IS_VALID(item.runningTime_)
+                    ? field("runningTimeMs", static_cast<double>(item.runningTime_) / GST_MSECOND)
+                    : field("runningTimeMs", std::string("null"))) +
+            "," + field("rtpTimestamp", rtpTimestamp) + "," + field("data", quote(item.data_)) + "}";
+
+        if (!message.empty() && message.size() + entry.size() + 2 > maxMessageSize)
+        {
+            messageSender_("{" + field("type", "metadata") + "," + field("items", message + "]") + "}");
+            message.clear();
+        }
+        message.append(message.empty() ? "[" : ",");
+        message.append(entry);
+    }
+    messageSender_("{" + field("type", "metadata") + "," + field("items", message + "]") + "}");
+}
+
+GstPadProbeReturn TimedMetadata::bufferProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData)
+{
+    reinterpret_cast<TimedMetadata*>(userData)->onBuffer(pad, GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_DROP;
+}
+
+gboolean TimedMetadata::batchTimerCallback(gpointer userData)
+{
+    reinterpret_cast<TimedMetadata*>(userData)->sendBatch();
+    return G_SOURCE_CONTINUE;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <functional>
+#include <glib.h>
+#include <gst/gst.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * KLV (SMPTE 336) and ID3 timed metadata streams of the source, sent on a data channel. The demuxed PES payloads are
+ * taken straight off the demux pads and collected, and the collection is sent from the main loop at most once per
+ * batch interval, which bounds the SCTP message rate however often the source sends metadata. Every item carries its
+ * running time and the RTP timestamp the video frame with the same running time gets, so receivers can show it in
+ * sync with the video.
+ */
+class TimedMetadata
+{
+public:
+    using MessageSender = std::function<void(const std::string& message)>;
+
+    TimedMetadata(GstElement* videoPayloader, MessageSender messageSender);
+    ~TimedMetadata();
+
+    static bool isMetadata(const char* capsName);
+    void attach(GstPad* demuxPad, const char* capsName);
+
+private:
+    struct Item
+    {
+        std::string stream_;
+        const char* format_;
+        GstClockTime runningTime_;
+        std::string data_;
+    };
+
+    GstElement* videoPayloader_;
+    MessageSender messageSender_;
+    guint batchTimerId_;
+
+    std::mutex itemsMutex_;
+    std::vector<Item> items_;
+
+    void onBuffer(GstPad* pad, GstBuffer* buffer);
+    void sendBatch();
+
+    static GstPadProbeReturn bufferProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData);
+    static gboolean batchTimerCallback(gpointer userData);
+};
@@ -0,0 +1,193 @@
+#include "TracerStats.h"
+#include "Logger.h"
+#include <algorithm>
+
+namespace
+{
+
+// Element mode times each element on its own instead of whole source to sink paths
+const char* tracers = "latency(flags=element);rusage";
+
+// The rusage tracer reports loads in per mille
+double loadPercent(guint load)
+{
+    return static_cast<double>(load) / 10.0;
+}
+
+} // namespace
+
+TracerStats* TracerStats::instance_ = nullptr;
+
+TracerStats::TracerStats(std::chrono::seconds interval)
+    : interval_(interval),
+      timerId_(0),
+      processLoad_(0),
+      intervalProcessCpuPercent_(0.0)
+{
+}
+
+void TracerStats::setEnvironment()
+{
+    // Both are read by gst_init
+    const auto userTracers = g_getenv("GST_TRACERS");
+    if (userTracers && userTracers[0] != '\0')
+    {
+        Logger::log("GST_TRACERS is set to %s, only its latency and rusage records are summarized", userTracers);
+    }
+    else
+    {
+        g_setenv("GST_TRACERS", tracers, TRUE);
+    }
+
+    const auto userDebug = g_getenv("GST_DEBUG");
+    const std::string debug =
+        userDebug && userDebug[0] != '\0' ? std::string(userDebug) + ",GST_TRACER:7" : std::string("GST_TRACER:7");
+    g_setenv("GST_DEBUG", debug.c_str(), TRUE);
+}
+
+void TracerStats::start(std::chrono::seconds interval)
+{
+    if (instance_)
+    {
+        return;
+    }
+
+    // Lives as long as the process, like the log function it is registered with
+    instance_ = new TracerStats(interval);
+    gst_debug_remove_log_function(gst_debug_log_default);
+    gst_debug_add_log_function(logFunction, instance_, nullptr);
+    instance_->timerId_ = g_timeout_add_seconds(interval.count(), intervalCallback, instance_);
+    Logger::log("Summarizing %s tracers every %llu s", tracers, static_cast<unsigned long long>(interval.count()));
+}
+
+void TracerStats::onThreadStarted(GstElement* owner)
+{
+    if (!owner)
+    {
+        return;
+    }
+
+    // Called from inside the new thread, the rusage tracer identifies threads by their GThread
+    const auto threadId = static_cast<guint64>(reinterpret_cast<guintptr>(g_thread_self()));
+    std::lock_guard<std::mutex> lock(mutex_);
+    threadOwners_[threadId] = GST_ELEMENT_NAME(owner);
+}
+
+bool TracerStats::getElementStats(const std::string& element, ElementStats& stats)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto findResult = intervalStats_.find(element);
+    if (findResult == intervalStats_.cend())
+    {
+        return false;
+    }
+    stats = findResult->second;
+    return true;
+}
+
+double TracerStats::getProcessCpuPercent()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return intervalProcessCpuPercent_;
+}
+
+void TracerStats::onRecord(const gchar* record)
+{
+    // The latency tracer also writes whole path and reported latencies, only these records are parsed
+    const auto elementLatency = g_str_has_prefix(record, "element-latency,");
+    const auto threadRusage = g_str_has_prefix(record, "thread-rusage,");
+    const auto procRusage = g_str_has_prefix(record, "proc-rusage,");
+    if (!elementLatency && !threadRusage && !procRusage)
+    {
+        return;
+    }
+
+    auto structure = gst_structure_from_string(record, nullptr);
+    if (!structure)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (elementLatency)
+    {
+        const auto element = gst_structure_get_string(structure, "element");
+        guint64 time = 0;
+        if (element && gst_structure_get_uint64(structure, "time", &time))
+        {
+            auto& counters = counters_[element];
+            ++counters.buffers_;
+            counters.latencySum_ += time;
+            counters.latencyMax_ = std::max(counters.latencyMax_, time);
+        }
+    }
+    else if (threadRusage)
+    {
+        guint64 threadId = 0;
+        guint load = 0;
+        if (gst_structure_get_uint64(structure, "thread-id", &threadId) &&
+            gst_structure_get_uint(structure, "current-cpuload", &load))
+        {
+            threadLoads_[threadId] = load;
+        }
+    }
+    else
+    {
+        gst_structure_get_uint(structure, "current-cpuload", &processLoad_);
+    }
+    gst_structure_free(structure);
+}
+
+void TracerStats::onInterval()
+{
+    const auto seconds = static_cast<double>(interval_.count());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    intervalStats_.clear();
+    for (const auto& counters : counters_)
+    {
+        auto& stats = intervalStats_[counters.first];
+        stats.buffersPerSecond_ = static_cast<double>(counters.second.buffers_) / seconds;
+        stats.meanLatencyMs_ = counters.second.buffers_ == 0
+            ? 0.0
+            : static_cast<double>(counters.second.latencySum_) / counters.second.buffers_ / GST_MSECOND;
+        stats.maxLatencyMs_ = static_cast<double>(counters.second.latencyMax_) / GST_MSECOND;
+    }
+
+    // rusage only reports a thread while buffers pass through it, threads without a record were idle
+    for (const auto& threadLoad : threadLoads_)
+    {
+        const auto owner = threadOwners_.find(threadLoad.first);
+        if (owner != threadOwners_.cend())
+        {
+            intervalStats_[owner->second].cpuPercent_ += loadPercent(threadLoad.second);
+        }
+    }
+    intervalProcessCpuPercent_ = loadPercent(processLoad_);
+
+    counters_.clear();
+    threadLoads_.clear();
+}
+
+void TracerStats::logFunction(GstDebugCategory* category,
+    GstDebugLevel level,
+    const gchar* file,
+    const gchar* function,
+    gint line,
+    GObject* object,
+    GstDebugMessage* message,
+    gpointer userData)
+{
+    if (g_strcmp0(gst_debug_category_get_name(category), "GST_TRACER") == 0)
+    {
+        reinterpret_cast<TracerStats*>(userData)->onRecord(gst_debug_message_get(message));
+        return;
+    }
+    gst_debug_log_default(category, level, file, function, line, object, message, nullptr);
+}
+
+gboolean TracerStats::intervalCallback(gpointer userData)
+{
+    reinterpret_cast<TracerStats*>(userData)->onInterval();
+    return G_SOURCE_CONTINUE;
+}
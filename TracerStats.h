@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <gst/gst.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+/**
+ * Aggregates the output of the GStreamer latency and rusage tracers per element, instead of leaving it in the debug
+ * log. The tracers are enabled through the environment before gst_init, and their records reach a debug log function
+ * that parses them instead of printing them. Other debug messages still go to the default log function.
+ *
+ * The latency tracer in element mode times every buffer from an element's sink pad to its src pad, which gives buffer
+ * rate and processing latency per element. The rusage tracer reports CPU load per streaming thread, each thread is
+ * charged to the element that started it, the source or queue whose thread runs everything up to the next queue.
+ * Every interval the counters are turned into per interval figures that the pipelines log and show in snapshots.
+ * Parsing a record per buffer and element costs CPU itself, this is meant to find hotspots, not to run always.
+ */
+class TracerStats
+{
+public:
+    struct ElementStats
+    {
+        ElementStats() : cpuPercent_(0.0), buffersPerSecond_(0.0), meanLatencyMs_(0.0), maxLatencyMs_(0.0) {}
+
+        double cpuPercent_;
+        double buffersPerSecond_;
+        double meanLatencyMs_;
+        double maxLatencyMs_;
+    };
+
+    static void setEnvironment();
+    static void start(std::chrono::seconds interval);
+    static TracerStats* get() { return instance_; }
+
+    void onThreadStarted(GstElement* owner);
+    bool getElementStats(const std::string& element, ElementStats& stats);
+    double getProcessCpuPercent();
+
+private:
+    struct Counters
+    {
+        Counters() : buffers_(0), latencySum_(0), latencyMax_(0) {}
+
+        uint64_t buffers_;
+        GstClockTime latencySum_;
+        GstClockTime latencyMax_;
+    };
+
+    static TracerStats* instance_;
+
+    std::chrono::seconds interval_;
+    guint timerId_;
+
+    std::mutex mutex_;
+    std::map<std::string, Counters> counters_;
+    std::map<guint64, std::string> threadOwners_;
+    std::map<guint64, guint> threadLoads_;
+    guint processLoad_;
+    std::map<std::string, ElementStats> intervalStats_;
+    double intervalProcessCpuPercent_;
+
+    explicit TracerStats(std::chrono::seconds interval);
+
+    void onRecord(const gchar* record);
+    void onInterval();
+
+    static void logFunction(GstDebugCategory* category,
+        GstDebugLevel level,
+        const gchar* file,
+        const gchar* function,
+        gint line,
+        GObject* object,
+        GstDebugMessage* message,
+        gpointer userData);
+    static gboolean intervalCallback(gpointer userData);
+};
@@ -0,0 +1,122 @@
+#include "VideoEncoder.h"
+
+namespace
+{
+
+// Frames one intra refresh wave takes, a lost packet is repaired within this many frames
+const guint lowLatencyRefreshFrames = 60;
+
+void setX264Bitrate(GstElement* encoder, uint32_t bitrateKbps)
+{
+    g_object_set(encoder, "bitrate", bitrateKbps, nullptr);
+}
+
+void configureX264(GstElement* encoder, uint32_t bitrateKbps, uint32_t threads)
+{
+    setX264Bitrate(encoder, bitrateKbps);
+    g_object_set(encoder,
+        "threads",
+        threads,
+        "tune",
+        0x4, // zerolatency, the flags are stillimage 0x1, fastdecode 0x2 and zerolatency 0x4
+        "speed-preset",
+        1, // ultrafast
+        nullptr);
+}
+
+void configureX264LowLatency(GstElement* encoder)
+{
+    // The zerolatency tune set by configureX264 has no lookahead and no B-frames already. Slices are encoded in
+    // parallel and sized to fit one RTP packet, and intra refresh over a wave of frames replaces the bitrate peak of
+    // periodic IDRs.
+    g_object_set(encoder,
+        "sliced-threads",
+        TRUE,
+        "intra-refresh",
+        TRUE,
+        "key-int-max",
+        lowLatencyRefreshFrames,
+        "option-string",
+        "slice-max-size=1200",
+        nullptr);
+}
+
+void setOpenH264Bitrate(GstElement* encoder, uint32_t bitrateKbps)
+{
+    g_object_set(encoder, "bitrate", bitrateKbps * 1000, nullptr);
+}
+
+void configureOpenH264(GstElement* encoder, uint32_t bitrateKbps, uint32_t threads)
+{
+    setOpenH264Bitrate(encoder, bitrateKbps);
+    g_object_set(encoder,
+        "multi-thread",
+        threads,
+        "rate-control",
+        1, // bitrate
+        "complexity",
+        0, // low
+        nullptr);
+}
+
+void setVp8Bitrate(GstElement* encoder, uint32_t bitrateKbps)
+{
+    g_object_set(encoder, "target-bitrate", bitrateKbps * 1000, nullptr);
+}
+
+void configureVp8(GstElement* encoder, uint32_t bitrateKbps, uint32_t threads)
+{
+    setVp8Bitrate(encoder, bitrateKbps);
+    g_object_set(encoder,
+        "deadline",
+        static_cast<gint64>(1), // realtime
+        "cpu-used",
+        8,
+        "end-usage",
+        1, // cbr
+        "lag-in-frames",
+        0,
+        "threads",
+        threads,
+        nullptr);
+}
+
+void setSvtAv1Bitrate(GstElement* encoder, uint32_t bitrateKbps)
+{
+    g_object_set(encoder, "target-bitrate", bitrateKbps, nullptr);
+}
+
+void configureSvtAv1(GstElement* encoder, uint32_t bitrateKbps, uint32_t threads)
+{
+    setSvtAv1Bitrate(encoder, bitrateKbps);
+    g_object_set(encoder,
+        "logical-processors",
+        threads,
+        "preset",
+        12, // fastest realtime preset
+        nullptr);
+}
+
+} // namespace
+
+const std::vector<VideoEncoder>& VideoEncoder::all()
+{
+    static const std::vector<VideoEncoder> encoders = {
+        {"x264", "x264enc", "rtph264pay", "H264", configureX264, setX264Bitrate, configureX264LowLatency},
+        {"openh264", "openh264enc", "rtph264pay", "H264", configureOpenH264, setOpenH264Bitrate, nullptr},
+        {"vp8", "vp8enc", "rtpvp8pay", "VP8", configureVp8, setVp8Bitrate, nullptr},
+        {"av1", "svtav1enc", "rtpav1pay", "AV1", configureSvtAv1, setSvtAv1Bitrate, nullptr}};
+    return encoders;
+}
+
+const VideoEncoder* VideoEncoder::find(const std::string& name)
+{
+    for (const auto& encoder : all())
+    {
+        if (name == encoder.name_)
+        {
+            return &encoder;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+
+/**
+ * A video encoder the pipeline can transcode to, with the payloader and RTP encoding name that go with it.
+ */
+struct VideoEncoder
+{
+    const char* name_;
+    const char* encoderFactory_;
+    const char* payloaderFactory_;
+    const char* encodingName_;
+    void (*configure_)(GstElement* encoder, uint32_t bitrateKbps, uint32_t threads);
+    // Only the rate control target, safe on a running encoder
+    void (*setBitrate_)(GstElement* encoder, uint32_t bitrateKbps);
+    // Settings for Config::lowLatency_, null if the encoder has nothing beyond what configure_ sets
+    void (*configureLowLatency_)(GstElement* encoder);
+
+    static const std::vector<VideoEncoder>& all();
+    static const VideoEncoder* find(const std::string& name);
+};
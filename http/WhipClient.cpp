@@ -1,13 +1,197 @@
 #include "http/WhipClient.h"
 #include "Logger.h"
+#include "utils/ScopedGLibMem.h"
 #include <algorithm>
 #include <cassert>
+#include <cctype>
 #include <libsoup/soup.h>
 #include <unordered_map>
 
 namespace
 {
 
+// Warm connections are kept across the POST, PATCH and DELETE of a session and shared between channels
+const guint idleTimeoutSeconds = 300;
+const gint maxConnectionsPerHost = 16;
+
+// WHIP load balancers answer the POST with 307/308 to the ingest node
+const uint32_t maxRedirects = 5;
+
+const char* httpVersionName(SoupHTTPVersion version)
+{
+    switch (version)
+    {
+    case SOUP_HTTP_1_0:
+        return "HTTP/1.0";
+    case SOUP_HTTP_1_1:
+        return "HTTP/1.1";
+    case SOUP_HTTP_2_0:
+        return "HTTP/2";
+    default:
+        return "HTTP/?";
+    }
+}
+
+double metricsIntervalMs(guint64 start, guint64 end)
+{
+    return start == 0 || end < start ? 0.0 : static_cast<double>(end - start) / 1000.0;
+}
+
+GBytes* sendAndRead(SoupSession* session, SoupMessage* message, const char* method, GError** error)
+{
+    soup_message_add_flags(message, SOUP_MESSAGE_COLLECT_METRICS);
+    auto responseBytes = soup_session_send_and_read(session, message, nullptr, error);
+
+    // Connect and TLS times are 0 when a pooled connection was reused
+    auto metrics = soup_message_get_metrics(message);
+    if (metrics)
+    {
+        const auto connectStart = soup_message_metrics_get_connect_start(metrics);
+        const auto tlsStart = soup_message_metrics_get_tls_start(metrics);
+        const auto connectEnd = soup_message_metrics_get_connect_end(metrics);
+        Logger::log("WHIP %s %s: dns %.1f ms, connect %.1f ms, tls %.1f ms, server %.1f ms, total %.1f ms%s",
+            method,
+            httpVersionName(soup_message_get_http_version(message)),
+            metricsIntervalMs(soup_message_metrics_get_dns_start(metrics), soup_message_metrics_get_dns_end(metrics)),
+            metricsIntervalMs(connectStart, tlsStart != 0 ? tlsStart : connectEnd),
+            metricsIntervalMs(tlsStart, connectEnd),
+            metricsIntervalMs(soup_message_metrics_get_request_start(metrics),
+                soup_message_metrics_get_response_start(metrics)),
+            metricsIntervalMs(soup_message_metrics_get_fetch_start(metrics),
+                soup_message_metrics_get_response_end(metrics)),
+            connectStart == 0 ? ", reused connection" : "");
+    }
+    return responseBytes;
+}
+
+void preconnectCallback(GObject* source, GAsyncResult* result, gpointer /*userData*/)
+{
+    GError* error = nullptr;
+    if (!soup_session_preconnect_finish(SOUP_SESSION(source), result, &error))
+    {
+        Logger::log("WHIP pre-connect failed: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+    Logger::log("WHIP pre-connect done");
+}
+
+std::string resolveUrl(GUri* baseUri, const std::string& resourceUrl)
+{
+    if (resourceUrl.find("http://") == 0 || resourceUrl.find("https://") == 0 || !baseUri)
+    {
+        // Already a full URL
+        return resourceUrl;
+    }
+
+    GUri* fullUri = g_uri_parse_relative(baseUri, resourceUrl.c_str(), G_URI_FLAGS_NONE, nullptr);
+    if (!fullUri)
+    {
+        Logger::log("Failed to construct full URL from resource: %s", resourceUrl.c_str());
+        return {};
+    }
+
+    gchar* fullUrlCStr = g_uri_to_string(fullUri);
+    std::string fullUrl(fullUrlCStr);
+    g_free(fullUrlCStr);
+    g_uri_unref(fullUri);
+    return fullUrl;
+}
+
+// Either delay seconds or an HTTP date
+std::chrono::seconds parseRetryAfter(const std::string& value)
+{
+    if (!value.empty() && std::isdigit(static_cast<unsigned char>(value[0])))
+    {
+        return std::chrono::seconds(std::strtoul(value.c_str(), nullptr, 10));
+    }
+
+    auto retryTime = soup_date_time_new_from_http_string(value.c_str());
+    if (!retryTime)
+    {
+        return std::chrono::seconds(0);
+    }
+    auto now = g_date_time_new_now_utc();
+    const auto delay = g_date_time_difference(retryTime, now) / G_TIME_SPAN_SECOND;
+    g_date_time_unref(now);
+    g_date_time_unref(retryTime);
+    return std::chrono::seconds(std::max<GTimeSpan>(delay, 0));
+}
+
+std::string linkParameter(const std::string& parameters, const char* name)
+{
+    const auto key = std::string(name) + "=";
+    auto start = parameters.find(key);
+    while (start != std::string::npos && start != 0 && parameters[start - 1] != ';' && parameters[start - 1] != ' ')
+    {
+        start = parameters.find(key, start + 1);
+    }
+    if (start == std::string::npos)
+    {
+        return {};
+    }
+
+    start += key.size();
+    if (start < parameters.size() && parameters[start] == '"')
+    {
+        const auto end = parameters.find('"', start + 1);
+        return parameters.substr(start + 1, end == std::string::npos ? std::string::npos : end - start - 1);
+    }
+    const auto end = parameters.find(';', start);
+    return parameters.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+// <turn:host:port?transport=tcp>; rel="ice-server"; username="u"; credential="p" becomes
+// turn://u:p@host:port?transport=tcp
+std::vector<std::string> parseIceServerLinks(const std::string& links)
+{
+    std::vector<std::string> result;
+    size_t position = 0;
+    while ((position = links.find('<', position)) != std::string::npos)
+    {
+        const auto uriEnd = links.find('>', position);
+        if (uriEnd == std::string::npos)
+        {
+            break;
+        }
+        const auto uri = links.substr(position + 1, uriEnd - position - 1);
+        const auto nextLink = links.find('<', uriEnd);
+        const auto parameters =
+            links.substr(uriEnd + 1, nextLink == std::string::npos ? std::string::npos : nextLink - uriEnd - 1);
+        position = uriEnd + 1;
+
+        if (linkParameter(parameters, "rel") != "ice-server")
+        {
+            continue;
+        }
+
+        const auto schemeEnd = uri.find(':');
+        if (schemeEnd == std::string::npos)
+        {
+            continue;
+        }
+        // A ?transport= query is kept, webrtcbin understands it
+        const auto scheme = uri.substr(0, schemeEnd);
+        const auto hostPort = uri.substr(schemeEnd + 1);
+        if (scheme == "stun" || scheme == "stuns")
+        {
+            result.push_back(scheme + "://" + hostPort);
+            continue;
+        }
+        if (scheme != "turn" && scheme != "turns")
+        {
+            continue;
+        }
+
+        utils::ScopedGLibMem<gchar*> username(
+            g_uri_escape_string(linkParameter(parameters, "username").c_str(), nullptr, FALSE));
+        utils::ScopedGLibMem<gchar*> credential(
+            g_uri_escape_string(linkParameter(parameters, "credential").c_str(), nullptr, FALSE));
+        result.push_back(scheme + "://" + username.get() + ":" + credential.get() + "@" + hostPort);
+    }
+    return result;
+}
+
 void iterateResponseHeaders(const char* name, const char* value, gpointer userData)
 {
     auto headers = reinterpret_cast<std::unordered_map<std::string, std::string>*>(userData);
@@ -25,9 +209,22 @@ namespace http
 
 struct WhipClient::OpaqueSoupData
 {
-    OpaqueSoupData() : soupSession_(nullptr) {}
+    OpaqueSoupData() : soupSession_(nullptr), baseUri_(nullptr) {}
+
+    ~OpaqueSoupData()
+    {
+        if (baseUri_)
+        {
+            g_uri_unref(baseUri_);
+        }
+        if (soupSession_)
+        {
+            g_object_unref(soupSession_);
+        }
+    }
 
     SoupSession* soupSession_;
+    GUri* baseUri_;
 };
 
 WhipClient::WhipClient(const std::string& url, const std::string& authKey)
@@ -44,6 +241,31 @@ WhipClient::WhipClient(const std::string& url, const std::string& authKey)
 
     // Set timeout (5 seconds)
     g_object_set(data_->soupSession_, "timeout", 5, nullptr);
+    g_object_set(data_->soupSession_,
+        "idle-timeout",
+        idleTimeoutSeconds,
+        "max-conns-per-host",
+        maxConnectionsPerHost,
+        nullptr);
+
+    // Resource URLs returned by the server are resolved against it for every PATCH and DELETE
+    data_->baseUri_ = g_uri_parse(url_.c_str(), G_URI_FLAGS_NONE, nullptr);
+    if (!data_->baseUri_)
+    {
+        Logger::log("Failed to parse base URL: %s", url_.c_str());
+        return;
+    }
+
+    // DNS, TCP and TLS (with ALPN picking HTTP/2 where the server offers it) are done while the pipeline starts up,
+    // the offer then goes out on the warm connection
+    auto preconnectMessage = soup_message_new_from_uri("POST", data_->baseUri_);
+    soup_session_preconnect_async(data_->soupSession_,
+        preconnectMessage,
+        G_PRIORITY_DEFAULT,
+        nullptr,
+        preconnectCallback,
+        nullptr);
+    g_object_unref(preconnectMessage);
 }
 
 WhipClient::~WhipClient()
@@ -56,84 +278,124 @@ WhipClient::~WhipClient()
 
 WhipClient::SendOfferResult WhipClient::sendOffer(const std::string& sdp)
 {
-    auto soupMessage = soup_message_new("POST", url_.c_str());
-    if (!soupMessage)
+    SendOfferResult result;
+    std::string url = url_;
+
+    for (uint32_t redirects = 0;; ++redirects)
     {
-        return {};
-    }
+        auto soupMessage = soup_message_new("POST", url.c_str());
+        if (!soupMessage)
+        {
+            return result;
+        }
 
-    // Set request body
-    GBytes* bytes = g_bytes_new(sdp.c_str(), sdp.size());
-    soup_message_set_request_body_from_bytes(soupMessage, "application/sdp", bytes);
-    g_bytes_unref(bytes);
+        // Redirects are followed here, the resource is then resolved against the endpoint that created it
+        soup_message_add_flags(soupMessage, SOUP_MESSAGE_NO_REDIRECT);
 
-    // Set authorization header if provided
-    if (!authKey_.empty())
-    {
-        // This is for Broadcast Box compatibility (same as OBS studio)
-        auto bearer_token_header = std::string("Bearer ") + authKey_;
-        SoupMessageHeaders* requestHeaders = soup_message_get_request_headers(soupMessage);
-        soup_message_headers_append(requestHeaders, "Authorization", bearer_token_header.c_str());
-    }
+        // Set request body
+        GBytes* bytes = g_bytes_new(sdp.c_str(), sdp.size());
+        soup_message_set_request_body_from_bytes(soupMessage, "application/sdp", bytes);
+        g_bytes_unref(bytes);
 
-    // Send the message synchronously
-    GError* error = nullptr;
-    GBytes* responseBytes = soup_session_send_and_read(data_->soupSession_, soupMessage, nullptr, &error);
+        // Set authorization header if provided
+        if (!authKey_.empty())
+        {
+            // This is for Broadcast Box compatibility (same as OBS studio)
+            auto bearer_token_header = std::string("Bearer ") + authKey_;
+            SoupMessageHeaders* requestHeaders = soup_message_get_request_headers(soupMessage);
+            soup_message_headers_append(requestHeaders, "Authorization", bearer_token_header.c_str());
+        }
 
-    auto statusCode = soup_message_get_status(soupMessage);
+        // Send the message synchronously
+        GError* error = nullptr;
+        GBytes* responseBytes = sendAndRead(data_->soupSession_, soupMessage, "POST", &error);
 
-    if (error || statusCode != 201)
-    {
-        Logger::log("Failed to send offer, status code: %d", statusCode);
-        if (error)
+        auto statusCode = soup_message_get_status(soupMessage);
+        result.statusCode_ = error ? 0 : statusCode;
+
+        // Get response headers
+        std::unordered_map<std::string, std::string> headers;
+        SoupMessageHeaders* responseHeaders = soup_message_get_response_headers(soupMessage);
+        soup_message_headers_foreach(responseHeaders, iterateResponseHeaders, &headers);
+        const auto locationItr = headers.find("location");
+
+        if (!error && (statusCode == 307 || statusCode == 308) && locationItr != headers.cend() &&
+            redirects < maxRedirects)
         {
-            Logger::log("Error: %s", error->message);
-            g_error_free(error);
+            url = resolveUrl(soup_message_get_uri(soupMessage), locationItr->second);
+            Logger::log("WHIP endpoint redirected (%u) to %s", statusCode, url.c_str());
+            if (responseBytes)
+            {
+                g_bytes_unref(responseBytes);
+            }
+            g_object_unref(soupMessage);
+            if (url.empty())
+            {
+                return result;
+            }
+            continue;
         }
-        if (responseBytes)
+
+        if (error || statusCode != 201)
         {
-            g_bytes_unref(responseBytes);
+            Logger::log("Failed to send offer, status code: %d", statusCode);
+            if (error)
+            {
+                Logger::log("Error: %s", error->message);
+                g_error_free(error);
+            }
+
+            const auto retryAfterItr = headers.find("retry-after");
+            if (retryAfterItr != headers.cend())
+            {
+                result.retryAfter_ = parseRetryAfter(retryAfterItr->second);
+            }
+            if (responseBytes)
+            {
+                g_bytes_unref(responseBytes);
+            }
+            g_object_unref(soupMessage);
+            return result;
         }
-        g_object_unref(soupMessage);
-        return {};
-    }
 
-    // Get response headers
-    std::unordered_map<std::string, std::string> headers;
-    SoupMessageHeaders* responseHeaders = soup_message_get_response_headers(soupMessage);
-    soup_message_headers_foreach(responseHeaders, iterateResponseHeaders, &headers);
+        if (locationItr == headers.cend())
+        {
+            g_bytes_unref(responseBytes);
+            g_object_unref(soupMessage);
+            return result;
+        }
 
-    const auto locationItr = headers.find("location");
-    if (locationItr == headers.cend())
-    {
-        g_bytes_unref(responseBytes);
-        g_object_unref(soupMessage);
-        return {};
-    }
+        result.resource_ = resolveUrl(soup_message_get_uri(soupMessage), locationItr->second);
 
-    SendOfferResult result;
-    result.resource_ = locationItr->second;
+        // Get response body
+        gsize dataSize;
+        const char* data = static_cast<const char*>(g_bytes_get_data(responseBytes, &dataSize));
+        result.sdpAnswer_ = std::string(data, dataSize);
 
-    // Get response body
-    gsize dataSize;
-    const char* data = static_cast<const char*>(g_bytes_get_data(responseBytes, &dataSize));
-    result.sdpAnswer_ = std::string(data, dataSize);
+        const auto etagItr = headers.find("etag");
+        if (etagItr != headers.cend())
+        {
+            result.etag_ = etagItr->second;
+        }
 
-    const auto etagItr = headers.find("etag");
-    if (etagItr != headers.cend())
-    {
-        result.etag_ = etagItr->second;
-    }
+        // Several Link headers are folded into one comma separated list
+        const auto links = soup_message_headers_get_list(responseHeaders, "Link");
+        if (links)
+        {
+            result.iceServers_ = parseIceServerLinks(links);
+        }
 
-    g_bytes_unref(responseBytes);
-    g_object_unref(soupMessage);
+        g_bytes_unref(responseBytes);
+        g_object_unref(soupMessage);
 
-    return result;
+        return result;
+    }
 }
 
 bool WhipClient::updateIce(const std::string& resourceUrl, const std::string& etag, std::string&& sdp)
 {
-    auto soupMessage = soup_message_new("PATCH", resourceUrl.c_str());
+    const auto fullUrl = resolveUrl(data_->baseUri_, resourceUrl);
+    auto soupMessage = fullUrl.empty() ? nullptr : soup_message_new("PATCH", fullUrl.c_str());
     if (!soupMessage)
     {
         return false;
@@ -157,7 +419,7 @@ bool WhipClient::updateIce(const std::string& resourceUrl, const std::string& et
 
     // Send the message synchronously
     GError* error = nullptr;
-    GBytes* responseBytes = soup_session_send_and_read(data_->soupSession_, soupMessage, nullptr, &error);
+    GBytes* responseBytes = sendAndRead(data_->soupSession_, soupMessage, "PATCH", &error);
 
     auto statusCode = soup_message_get_status(soupMessage);
 
@@ -189,37 +451,10 @@ bool WhipClient::deleteSession(const std::string& resourceUrl)
     }
 
     // Construct full URL from base URL and resource path
-    std::string fullUrl;
-    if (resourceUrl.find("http://") == 0 || resourceUrl.find("https://") == 0)
-    {
-        // Already a full URL
-        fullUrl = resourceUrl;
-    }
-    else
+    const auto fullUrl = resolveUrl(data_->baseUri_, resourceUrl);
+    if (fullUrl.empty())
     {
-        // Relative URL - need to construct full URL from base
-        // Parse base URL to get scheme, host, and port
-        GUri* baseUri = g_uri_parse(url_.c_str(), G_URI_FLAGS_NONE, nullptr);
-        if (!baseUri)
-        {
-            Logger::log("Failed to parse base URL: %s", url_.c_str());
-            return false;
-        }
-
-        // Build full URL
-        GUri* fullUri = g_uri_parse_relative(baseUri, resourceUrl.c_str(), G_URI_FLAGS_NONE, nullptr);
-        g_uri_unref(baseUri);
-
-        if (!fullUri)
-        {
-            Logger::log("Failed to construct full URL from resource: %s", resourceUrl.c_str());
-            return false;
-        }
-
-        gchar* fullUrlCStr = g_uri_to_string(fullUri);
-        fullUrl = std::string(fullUrlCStr);
-        g_free(fullUrlCStr);
-        g_uri_unref(fullUri);
+        return false;
     }
 
     Logger::log("Sending DELETE request to: %s", fullUrl.c_str());
@@ -241,7 +476,7 @@ bool WhipClient::deleteSession(const std::string& resourceUrl)
 
     // Send the message synchronously
     GError* error = nullptr;
-    GBytes* responseBytes = soup_session_send_and_read(data_->soupSession_, soupMessage, nullptr, &error);
+    GBytes* responseBytes = sendAndRead(data_->soupSession_, soupMessage, "DELETE", &error);
 
     auto statusCode = soup_message_get_status(soupMessage);
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -11,10 +13,19 @@ class WhipClient
 public:
     struct SendOfferResult
     {
+        SendOfferResult() : statusCode_(0), retryAfter_(0) {}
+
         std::string resource_;
         std::string etag_;
         std::vector<std::string> extensions_;
         std::string sdpAnswer_;
+
+        // ICE servers from Link headers, as webrtcbin stun-server/turn-server URLs
+        std::vector<std::string> iceServers_;
+
+        // Of the last response, 0 when no response was received
+        uint32_t statusCode_;
+        std::chrono::seconds retryAfter_;
     };
 
     WhipClient(const std::string& url, const std::string& authKey);
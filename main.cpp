@@ -1,12 +1,21 @@
 #include "Config.h"
+#include "ControlSocket.h"
 #include "http/WhipClient.h"
 #include "Logger.h"
 #include "Pipeline.h"
+#include "SrtListener.h"
+#include "TracerStats.h"
+#include "VideoEncoder.h"
+#include "utils/Json.h"
+#include <algorithm>
 #include <chrono>
 #include <csignal>
 #include <cstdint>
+#include <cstring>
 #include <getopt.h>
+#include <sstream>
 #include <glib-2.0/glib.h>
+#include <glib-unix.h>
 
 namespace
 {
@@ -30,6 +39,43 @@ namespace
     {"bypass-audio", no_argument, nullptr, 0},
     {"bypass-video", no_argument, nullptr, 0},
     {"ignore-pcr", no_argument, nullptr, 0},
+    {"restreamDestination", required_argument, nullptr, 0},
+    {"restreamQueueMaxTime", required_argument, nullptr, 0},
+    {"statsInterval", required_argument, nullptr, 0},
+    {"srtStreamIdMap", required_argument, nullptr, 0},
+    {"srtLatencyAutoTune", no_argument, nullptr, 0},
+    {"srtLatencyMin", required_argument, nullptr, 0},
+    {"srtLatencyMax", required_argument, nullptr, 0},
+    {"pcrClockRecovery", no_argument, nullptr, 0},
+    {"rtpPacing", no_argument, nullptr, 0},
+    {"fastStart", no_argument, nullptr, 0},
+    {"keyframeMinInterval", required_argument, nullptr, 0},
+    {"videoEncoder", required_argument, nullptr, 0},
+    {"videoEncoderBenchmark", no_argument, nullptr, 0},
+    {"audioLanguage", required_argument, nullptr, 0},
+    {"audioTracks", required_argument, nullptr, 0},
+    {"encoderThreads", required_argument, nullptr, 0},
+    {"decoderThreads", required_argument, nullptr, 0},
+    {"cpuSet", required_argument, nullptr, 0},
+    {"numaNode", required_argument, nullptr, 0},
+    {"cpusPerChannel", required_argument, nullptr, 0},
+    {"ingestPriority", required_argument, nullptr, 0},
+    {"controlSocket", required_argument, nullptr, 0},
+    {"sourceIdleTimeout", required_argument, nullptr, 0},
+    {"slateFile", required_argument, nullptr, 0},
+    {"scte35", no_argument, nullptr, 0},
+    {"captions", required_argument, nullptr, 0},
+    {"timedMetadata", no_argument, nullptr, 0},
+    {"recordDirectory", required_argument, nullptr, 0},
+    {"recordSegmentDuration", required_argument, nullptr, 0},
+    {"recordSegments", required_argument, nullptr, 0},
+    {"recordSegmentSize", required_argument, nullptr, 0},
+    {"inputFile", required_argument, nullptr, 0},
+    {"inputFast", no_argument, nullptr, 0},
+    {"fakeOutput", no_argument, nullptr, 0},
+    {"tracers", no_argument, nullptr, 0},
+    {"memoryBudget", required_argument, nullptr, 0},
+    {"lowLatency", no_argument, nullptr, 0},
     {nullptr, no_argument, nullptr, 0}};
 
 const auto shortOptions = "a:p:u:k:d:r:o:b:m:ts";
@@ -53,15 +99,160 @@ const char* usageString = "Usage: whip-mpegts [OPTION]\n"
                           "  --no-video\n"
                           "  --bypass-audio\n"
                           "  --bypass-video\n"
-                          "  --ignore-pcr (can also use IGNORE_PCR env var)\n";
+                          "  --ignore-pcr (can also use IGNORE_PCR env var)\n"
+                          "  --restreamDestination STRING (udp://host:port or srt://host:port, repeatable)\n"
+                          "  --restreamQueueMaxTime INT ms (default=500)\n"
+                          "  --statsInterval INT s (0=off, default=10)\n"
+                          "  --srtStreamIdMap STRING (file, SRT listener for many callers routed by stream id)\n"
+                          "  --srtLatencyAutoTune (SRT latency from 4 x measured RTT)\n"
+                          "  --srtLatencyMin INT ms (default=60)\n"
+                          "  --srtLatencyMax INT ms (default=5000)\n"
+                          "  --pcrClockRecovery (run the pipeline on a clock recovered from the source PCR)\n"
+                          "  --rtpPacing (spread RTP video packets of a frame over time)\n"
+                          "  --fastStart (send the WHIP offer before the source stream is detected)\n"
+                          "  --keyframeMinInterval INT ms (default=500)\n"
+                          "  --videoEncoder STRING (x264, openh264, vp8 or av1, default=x264)\n"
+                          "  --videoEncoderBenchmark (log cpu/frame, latency and bitrate of all video encoders)\n"
+                          "  --audioLanguage STRING (ISO 639 codes in order of preference, e.g. eng,deu)\n"
+                          "  --audioTracks INT (audio tracks sent, default=1)\n"
+                          "  --encoderThreads INT (video encoder threads, default=2)\n"
+                          "  --decoderThreads INT (decoder threads, 0=auto, default=0)\n"
+                          "  --cpuSet STRING (CPUs for streaming threads, e.g. 0-3,8)\n"
+                          "  --numaNode INT (restrict streaming threads to the CPUs of a NUMA node)\n"
+                          "  --cpusPerChannel INT (CPUs of the set given to each channel in turn, 0=all)\n"
+                          "  --ingestPriority INT (SCHED_FIFO priority of ingest threads, 0=off)\n"
+                          "  --controlSocket STRING (unix socket path, returns a JSON snapshot of the pipelines)\n"
+                          "  --sourceIdleTimeout INT ms (park decoding and encoding without source data, 0=off)\n"
+                          "  --slateFile STRING (H264 and Opus MPEG-TS clip shown while the source is idle)\n"
+                          "  --scte35 (forward SCTE-35 cues on a data channel, IDR at splice points)\n"
+                          "  --captions STRING (sei, datachannel or off, default=off)\n"
+                          "  --timedMetadata (forward KLV and ID3 metadata streams on a data channel)\n"
+                          "  --recordDirectory STRING (record the source TS to a ring of segment files)\n"
+                          "  --recordSegmentDuration INT s (default=60)\n"
+                          "  --recordSegments INT (default=10)\n"
+                          "  --recordSegmentSize INT MiB (preallocated per segment, default=256)\n"
+                          "  --inputFile STRING (TS or .pcap file instead of the network source)\n"
+                          "  --inputFast (replay the input file as fast as possible instead of in real time)\n"
+                          "  --fakeOutput (discard the RTP output instead of sending it to the WHIP endpoint)\n"
+                          "  --tracers (per element CPU, buffer rate and latency every stats interval)\n"
+                          "  --memoryBudget INT MiB (per channel, drop at ingest above it, 0=off, default=0)\n"
+                          "  --lowLatency (sliced threads, intra refresh, no RTP pacing)\n";
 
 GMainLoop* mainLoop = nullptr;
 std::unique_ptr<Pipeline> pipeline;
 std::unique_ptr<http::WhipClient> whipClient;
+std::unique_ptr<SrtListener> srtListener;
+std::unique_ptr<ControlSocket> controlSocket;
 
-void intSignalHandler(int32_t)
+bool parseRestreamDestination(const char* uri, Config::RestreamDestination& destination)
 {
-    Logger::log("Received SIGINT, shutting down gracefully...");
+    std::string uriString(uri);
+    std::string address;
+
+    if (uriString.rfind("udp://", 0) == 0)
+    {
+        destination.srt_ = false;
+        address = uriString.substr(6);
+    }
+    else if (uriString.rfind("srt://", 0) == 0)
+    {
+        destination.srt_ = true;
+        address = uriString.substr(6);
+    }
+    else
+    {
+        return false;
+    }
+
+    const auto portSeparator = address.rfind(':');
+    if (portSeparator == std::string::npos || portSeparator == 0)
+    {
+        return false;
+    }
+
+    destination.address_ = address.substr(0, portSeparator);
+    destination.port_ = std::strtoul(address.c_str() + portSeparator + 1, nullptr, 10);
+    return destination.port_ != 0;
+}
+
+// Plugins are optional packages, a missing one is reported before any pipeline is built
+bool hasElementFactory(const char* factoryName)
+{
+    auto factory = gst_element_factory_find(factoryName);
+    if (!factory)
+    {
+        return false;
+    }
+    gst_object_unref(factory);
+    return true;
+}
+
+// set NAME VALUE [STREAMID], without a stream id every SRT caller's pipeline is changed
+std::string onSetCommand(std::istringstream& arguments)
+{
+    std::string name;
+    std::string value;
+    std::string streamId;
+    arguments >> name >> value >> streamId;
+    if (name.empty() || value.empty())
+    {
+        return "{" + utils::Json::field("error", "usage: set NAME VALUE [STREAMID]") + "}";
+    }
+
+    auto ok = true;
+    if (pipeline)
+    {
+        ok = pipeline->setParameter(name, value);
+    }
+    if (srtListener)
+    {
+        srtListener->forEachPipeline([&](const std::string& callerStreamId, Pipeline& callerPipeline) {
+            if (streamId.empty() || streamId == callerStreamId)
+            {
+                ok &= callerPipeline.setParameter(name, value);
+            }
+        });
+    }
+    return "{" + utils::Json::field("ok", ok) + "}";
+}
+
+std::string onControlCommand(const std::string& command)
+{
+    std::istringstream arguments(command);
+    std::string verb;
+    arguments >> verb;
+    if (verb == "set")
+    {
+        return onSetCommand(arguments);
+    }
+    if (!verb.empty() && verb != "stats")
+    {
+        return "{" + utils::Json::field("error", utils::Json::quote("unknown command " + verb)) + "}";
+    }
+
+    if (pipeline)
+    {
+        return pipeline->getSnapshot();
+    }
+
+    // One snapshot per SRT caller, keyed by stream id
+    std::string result = "{";
+    if (srtListener)
+    {
+        srtListener->forEachPipeline([&result](const std::string& streamId, Pipeline& callerPipeline) {
+            result.append(result.size() > 1 ? "," : "");
+            result.append(utils::Json::quote(streamId) + ":" + callerPipeline.getSnapshot());
+        });
+    }
+    return result + "}";
+}
+
+void shutdown()
+{
+    if (srtListener)
+    {
+        srtListener->stop();
+    }
 
     if (pipeline)
     {
@@ -81,21 +272,30 @@ void intSignalHandler(int32_t)
     g_main_loop_quit(mainLoop);
 }
 
+// Runs on the main loop, the shutdown takes locks, joins threads and makes HTTP requests
+gboolean intSignalCallback(gpointer /*userData*/)
+{
+    Logger::log("Received SIGINT, shutting down gracefully...");
+    shutdown();
+    return G_SOURCE_REMOVE;
+}
+
+gboolean endOfInputCallback(gpointer /*userData*/)
+{
+    Logger::log("Input file done, shutting down...");
+    shutdown();
+    return G_SOURCE_REMOVE;
+}
+
 } // namespace
 
 int32_t main(int32_t argc, char** argv)
 {
-    {
-        struct sigaction sigactionData = {};
-        sigactionData.sa_handler = intSignalHandler;
-        sigactionData.sa_flags = 0;
-        sigemptyset(&sigactionData.sa_mask);
-        sigaction(SIGINT, &sigactionData, nullptr);
-    }
+    g_unix_signal_add(SIGINT, intSignalCallback, nullptr);
 
     Config config;
     int32_t getOptResult;
-    int32_t optIndex;
+    int32_t optIndex = -1;
 
     while ((getOptResult = getopt_long(argc, argv, shortOptions, longOptions, &optIndex)) != -1)
     {
@@ -169,30 +369,255 @@ int32_t main(int32_t argc, char** argv)
         case 18:
             config.ignorePcr_ = true;
             break;
+        case 19:
+        {
+            Config::RestreamDestination destination;
+            if (!parseRestreamDestination(optarg, destination))
+            {
+                printf("Invalid restream destination %s\n", optarg);
+                return 1;
+            }
+            config.restreamDestinations_.push_back(std::move(destination));
+            break;
+        }
+        case 20:
+            config.restreamQueueMaxTime_ = std::chrono::milliseconds(std::strtoull(optarg, nullptr, 10));
+            break;
+        case 21:
+            config.statsInterval_ = std::chrono::seconds(std::strtoull(optarg, nullptr, 10));
+            break;
+        case 22:
+            config.srtStreamIdMap_ = optarg;
+            break;
+        case 23:
+            config.srtLatencyAutoTune_ = true;
+            break;
+        case 24:
+            config.srtLatencyMin_ = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 25:
+            config.srtLatencyMax_ = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 26:
+            config.pcrClockRecovery_ = true;
+            break;
+        case 27:
+            config.rtpPacing_ = true;
+            break;
+        case 28:
+            config.fastStart_ = true;
+            break;
+        case 29:
+            config.keyframeMinInterval_ = std::chrono::milliseconds(std::strtoull(optarg, nullptr, 10));
+            break;
+        case 30:
+            if (!VideoEncoder::find(optarg))
+            {
+                printf("Unknown video encoder %s\n", optarg);
+                return 1;
+            }
+            config.videoEncoder_ = optarg;
+            break;
+        case 31:
+            config.videoEncoderBenchmark_ = true;
+            break;
+        case 32:
+        {
+            std::string languages(optarg);
+            size_t start = 0;
+            while (start <= languages.size())
+            {
+                const auto end = std::min(languages.find(',', start), languages.size());
+                if (end > start)
+                {
+                    config.audioLanguages_.push_back(languages.substr(start, end - start));
+                }
+                start = end + 1;
+            }
+            break;
+        }
+        case 33:
+            config.audioTracks_ = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 34:
+            config.encoderThreads_ = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 35:
+            config.decoderThreads_ = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 36:
+            config.cpuSet_ = optarg;
+            break;
+        case 37:
+            config.numaNode_ = std::strtol(optarg, nullptr, 10);
+            break;
+        case 38:
+            config.cpusPerChannel_ = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 39:
+            config.ingestPriority_ = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 40:
+            config.controlSocket_ = optarg;
+            break;
+        case 41:
+            config.sourceIdleTimeout_ = std::chrono::milliseconds(std::strtoull(optarg, nullptr, 10));
+            break;
+        case 42:
+            config.slateFile_ = optarg;
+            break;
+        case 43:
+            config.scte35_ = true;
+            break;
+        case 44:
+            if (strcmp(optarg, "sei") == 0)
+            {
+                config.captions_ = Config::CaptionMode::SEI;
+            }
+            else if (strcmp(optarg, "datachannel") == 0)
+            {
+                config.captions_ = Config::CaptionMode::DATA_CHANNEL;
+            }
+            else if (strcmp(optarg, "off") == 0)
+            {
+                config.captions_ = Config::CaptionMode::OFF;
+            }
+            else
+            {
+                printf("Unknown captions mode %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 45:
+            config.timedMetadata_ = true;
+            break;
+        case 46:
+            config.recordDirectory_ = optarg;
+            break;
+        case 47:
+            config.recordSegmentDuration_ = std::chrono::seconds(std::strtoull(optarg, nullptr, 10));
+            break;
+        case 48:
+            config.recordSegments_ = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 49:
+            config.recordSegmentSize_ = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 50:
+            config.inputFile_ = optarg;
+            break;
+        case 51:
+            config.inputFast_ = true;
+            break;
+        case 52:
+            config.fakeOutput_ = true;
+            break;
+        case 53:
+            config.tracers_ = true;
+            break;
+        case 54:
+            config.memoryBudget_ = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 55:
+            config.lowLatency_ = true;
+            break;
         default:
             break;
         }
+
+        // getopt_long only sets the index for long options, don't let it leak into the next short option
+        optIndex = -1;
     }
 
-    if (config.whipEndpointUrl_.empty() || config.udpSourcePort_ == 0 ||
+    if ((config.whipEndpointUrl_.empty() && config.srtStreamIdMap_.empty() && !config.fakeOutput_) ||
+        (config.udpSourcePort_ == 0 && config.inputFile_.empty()) ||
         (!config.restreamAddress_.empty() && config.restreamPort_ == 0))
     {
         printf("%s\n", usageString);
         return 1;
     }
+
+    if (!config.restreamAddress_.empty())
+    {
+        config.restreamDestinations_.insert(config.restreamDestinations_.begin(),
+            Config::RestreamDestination{config.restreamAddress_, config.restreamPort_, config.srtTransport_});
+    }
+
     Logger::log("Config:\n%s", config.toString().c_str());
 
+    if (config.tracers_ && config.statsInterval_.count() == 0)
+    {
+        Logger::log("--tracers needs a stats interval, tracers not enabled");
+        config.tracers_ = false;
+    }
+    if (config.tracers_)
+    {
+        TracerStats::setEnvironment();
+    }
+
+    gst_init(nullptr, nullptr);
+    if (config.video_)
+    {
+        // Passthrough video is payloaded as H264, see Pipeline
+        const auto videoEncoder = VideoEncoder::find(config.bypass_video_ ? "x264" : config.videoEncoder_);
+        if (!config.bypass_video_ && !hasElementFactory(videoEncoder->encoderFactory_))
+        {
+            printf("Video encoder %s needs the GStreamer element %s, which is not installed\n",
+                videoEncoder->name_,
+                videoEncoder->encoderFactory_);
+            return 1;
+        }
+        if (!hasElementFactory(videoEncoder->payloaderFactory_))
+        {
+            printf("%s video needs the GStreamer element %s, which is not installed\n",
+                videoEncoder->encodingName_,
+                videoEncoder->payloaderFactory_);
+            return 1;
+        }
+    }
+    if (config.tracers_)
+    {
+        TracerStats::start(config.statsInterval_);
+    }
     mainLoop = g_main_loop_new(nullptr, FALSE);
 
-    whipClient = std::make_unique<http::WhipClient>(config.whipEndpointUrl_, config.whipEndpointAuthKey_);
-    pipeline = std::make_unique<Pipeline>(*whipClient, config);
-    pipeline->run();
+    if (!config.srtStreamIdMap_.empty())
+    {
+        srtListener = std::make_unique<SrtListener>(config);
+        if (!srtListener->start())
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        whipClient = std::make_unique<http::WhipClient>(config.whipEndpointUrl_, config.whipEndpointAuthKey_);
+        pipeline = std::make_unique<Pipeline>(*whipClient, config);
+        if (!config.inputFile_.empty())
+        {
+            // Called from a streaming thread, the shutdown runs on the main loop
+            pipeline->setEndOfInputHandler([]() { g_idle_add(endOfInputCallback, nullptr); });
+        }
+        pipeline->run();
+    }
+
+    if (!config.controlSocket_.empty())
+    {
+        controlSocket = std::make_unique<ControlSocket>(config.controlSocket_, onControlCommand);
+        if (!controlSocket->start())
+        {
+            return 1;
+        }
+    }
 
     g_main_loop_run(mainLoop);
 
     // Clean up
+    controlSocket.reset();
+    srtListener.reset();
     pipeline.reset();
     whipClient.reset();
+    gst_deinit();
 
     return 0;
 }
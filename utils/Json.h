@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace utils
+{
+
+/**
+ * Just enough JSON writing for the control socket snapshots, callers assemble objects and arrays themselves.
+ */
+namespace Json
+{
+
+inline std::string quote(const std::string& value)
+{
+    std::string result = "\"";
+    for (const auto character : value)
+    {
+        switch (character)
+        {
+        case '"':
+            result.append("\\\"");
+            break;
+        case '\\':
+            result.append("\\\\");
+            break;
+        case '\n':
+            result.append("\\n");
+            break;
+        default:
+            if (static_cast<unsigned char>(character) < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", character);
+                result.append(escaped);
+            }
+            else
+            {
+                result.push_back(character);
+            }
+            break;
+        }
+    }
+    result.push_back('"');
+    return result;
+}
+
+inline std::string field(const char* name, const std::string& jsonValue)
+{
+    return quote(name) + ":" + jsonValue;
+}
+
+inline std::string field(const char* name, const char* value)
+{
+    return field(name, value ? quote(value) : std::string("null"));
+}
+
+inline std::string field(const char* name, bool value)
+{
+    return field(name, std::string(value ? "true" : "false"));
+}
+
+inline std::string field(const char* name, int64_t value)
+{
+    return field(name, std::to_string(value));
+}
+
+inline std::string field(const char* name, uint64_t value)
+{
+    return field(name, std::to_string(value));
+}
+
+inline std::string field(const char* name, double value)
+{
+    char formatted[32];
+    snprintf(formatted, sizeof(formatted), "%.3f", value);
+    return field(name, std::string(formatted));
+}
+
+} // namespace Json
+
+} // namespace utils
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace utils
+{
+
+/**
+ * Minimal accessors for 188 byte MPEG-TS packets, no validation beyond what the accessor itself needs.
+ */
+namespace TsPacket
+{
+
+const size_t size = 188;
+const uint8_t syncByte = 0x47;
+const uint16_t nullPid = 0x1FFF;
+
+// PCR is a 33 bit 90 kHz base times 300 plus a 9 bit 27 MHz extension
+const uint64_t pcrClockRate = 27000000;
+const uint64_t pcrWrap = (uint64_t(1) << 33) * 300;
+
+inline uint16_t pid(const uint8_t* packet)
+{
+    return static_cast<uint16_t>(((packet[1] & 0x1F) << 8) | packet[2]);
+}
+
+inline bool payloadUnitStart(const uint8_t* packet)
+{
+    return (packet[1] & 0x40) != 0;
+}
+
+inline bool hasAdaptationField(const uint8_t* packet)
+{
+    return (packet[3] & 0x20) != 0;
+}
+
+inline bool hasPayload(const uint8_t* packet)
+{
+    return (packet[3] & 0x10) != 0;
+}
+
+inline bool randomAccess(const uint8_t* packet)
+{
+    return hasAdaptationField(packet) && packet[4] > 0 && (packet[5] & 0x40) != 0;
+}
+
+inline bool pcr(const uint8_t* packet, uint64_t& pcr)
+{
+    if (!hasAdaptationField(packet) || packet[4] < 7 || (packet[5] & 0x10) == 0)
+    {
+        return false;
+    }
+
+    const uint64_t base = (uint64_t(packet[6]) << 25) | (uint64_t(packet[7]) << 17) | (uint64_t(packet[8]) << 9) |
+        (uint64_t(packet[9]) << 1) | (packet[10] >> 7);
+    const uint64_t extension = (uint64_t(packet[10] & 0x01) << 8) | packet[11];
+    pcr = base * 300 + extension;
+    return true;
+}
+
+inline const uint8_t* payload(const uint8_t* packet, size_t& payloadSize)
+{
+    size_t offset = 4;
+    if (hasAdaptationField(packet))
+    {
+        offset += 1 + packet[4];
+    }
+
+    if (!hasPayload(packet) || offset >= size)
+    {
+        payloadSize = 0;
+        return nullptr;
+    }
+
+    payloadSize = size - offset;
+    return packet + offset;
+}
+
+/**
+ * Offset of the first packet start in data, where the next packet also starts with a sync byte. Returns length if
+ * there is none.
+ */
+inline size_t findSync(const uint8_t* data, size_t length)
+{
+    for (size_t offset = 0; offset + size <= length; ++offset)
+    {
+        if (data[offset] == syncByte && (offset + size == length || data[offset + size] == syncByte))
+        {
+            return offset;
+        }
+    }
+    return length;
+}
+
+} // namespace TsPacket
+
+} // namespace utils